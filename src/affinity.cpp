@@ -0,0 +1,94 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "affinity.h"
+#include <QStringList>
+#include <QDebug>
+extern "C" {
+#include <pthread.h>
+#include <sched.h>
+}
+
+static AffinitySettings configuredAffinity;
+
+QList<int> parseCpuList(const QString& cpus)
+{
+    QList<int> list;
+    for (auto& item: cpus.split(',', QString::SkipEmptyParts)) {
+        auto range = item.trimmed().split('-');
+        bool ok1 = false, ok2 = false;
+        int first = range.first().toInt(&ok1);
+        int last = range.last().toInt(&ok2);
+        if (range.size() > 2 || !ok1 || !ok2 ||
+            first < 0 || last < first || last >= CPU_SETSIZE)
+            return QList<int>();
+        for (int cpu = first; cpu <= last; cpu++)
+            list << cpu;
+    }
+    return list;
+}
+
+QString configureAffinity(const AffinitySettings& settings)
+{
+    const QString* lists[] = {
+        &settings.workerCpus, &settings.ioCpus, &settings.readerCpus
+    };
+    for (auto l: lists) {
+        if (!l->trimmed().isEmpty() && parseCpuList(*l).isEmpty())
+            return QString("Invalid CPU list: %1").arg(*l);
+    }
+    configuredAffinity = settings;
+    return QString{};
+}
+
+const AffinitySettings& affinitySettings()
+{
+    return configuredAffinity;
+}
+
+void pinCurrentThread(ThreadRole role)
+{
+    static thread_local bool pinned = false;
+    if (pinned)
+        return;
+    pinned = true;
+
+    QString cpus;
+    switch (role) {
+    case ThreadRole::Worker:
+        cpus = configuredAffinity.workerCpus;
+        break;
+    case ThreadRole::IO:
+        cpus = configuredAffinity.ioCpus;
+        break;
+    case ThreadRole::Reader:
+        cpus = configuredAffinity.readerCpus;
+        break;
+    }
+    auto list = parseCpuList(cpus);
+    if (list.isEmpty())
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu: list)
+        CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err)
+        qDebug() << "Could not set thread affinity to" << cpus;
+}
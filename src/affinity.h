@@ -0,0 +1,61 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <QString>
+#include <QList>
+
+/*
+ * Optional pinning of threads to sets of CPUs. On multi-socket machines,
+ * pinning everything that touches a frame to the CPUs of one node keeps
+ * the threads from wandering across sockets. Since memory is placed on
+ * the node of the thread that first touches it, buffers allocated by
+ * pinned threads also end up local to the threads that use them.
+ *
+ * CPU sets are given as lists like "0-7,16-23". An empty list means
+ * that threads of that role are left to the scheduler.
+ */
+struct AffinitySettings
+{
+    QString workerCpus; // Threads running processData().
+    QString ioCpus;     // Threads saving images.
+    QString readerCpus; // Background threads of video sources.
+};
+
+enum class ThreadRole
+{
+    Worker,
+    IO,
+    Reader
+};
+
+// Returns the CPUs in the list, or an empty list if it cannot be parsed.
+QList<int> parseCpuList(const QString& cpus);
+
+// Set the process-wide configuration. Call before any processing starts.
+// Returns an error message if any of the lists is invalid.
+QString configureAffinity(const AffinitySettings& settings);
+const AffinitySettings& affinitySettings();
+
+// Pin the calling thread to the CPUs configured for its role. Cheap to call
+// repeatedly; the system call is only made the first time in each thread.
+void pinCurrentThread(ThreadRole role);
+
+#endif
@@ -17,12 +17,15 @@
  */
 
 #include "arifmainwindow.h"
+#include "qualityindex.h"
 #include <QTimer>
 #include <QSettings>
 #include <QMessageBox>
 #include <QFileDialog>
 #include <QMetaType>
 #include <QInputDialog>
+#include <QDataStream>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include <QDebug>
 #include <cassert>
@@ -31,6 +34,27 @@ typedef QMap<QString, EstimatorSettings> Presets;
 Q_DECLARE_METATYPE(Presets)
 
 static uint fpsUpdateSec = 3;
+// Memory for previews kept for scrubbing through a video, in KiB.
+static const int previewCacheKiB = 256 * 1024;
+// Previews rendered ahead of the seek slider in the direction it moves.
+static const int prefetchedPreviews = 2;
+
+// Settings that change how a preview looks.
+static QByteArray renderKey(const ProcessingSettings& s)
+{
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << s.negative << s.markClipped << s.logarithmicHistograms;
+    return key;
+}
+
+static int previewCost(const SharedData& d)
+{
+    qint64 bytes = qint64(d->renderedFrame.bytesPerLine()) *
+                   d->renderedFrame.height() +
+                   d->decoded.total() * d->decoded.elemSize();
+    return qMax<qint64>(1, bytes / 1024);
+}
 
 ArifMainWindow::ArifMainWindow(VideoSourcePlugin* plugin, QWidget* videoControls,
                                QString settingsFile, QString destinationDir,
@@ -39,6 +63,7 @@ ArifMainWindow::ArifMainWindow(VideoSourcePlugin* plugin, QWidget* videoControls
 {
     settings.plugin = plugin;
     setupUi(this);
+    previewCache.setMaxCost(previewCacheKiB);
     if (sourceControl) {
         sourceControlDock->setWidget(sourceControl);
         sourceControlDock->setVisible(true);
@@ -77,6 +102,13 @@ ArifMainWindow::ArifMainWindow(VideoSourcePlugin* plugin, QWidget* videoControls
     QTimer::singleShot(0, this, SLOT(initialize()));
 }
 
+ArifMainWindow::~ArifMainWindow()
+{
+    // The foreman must not run while it is being destroyed.
+    foremanThread.quit();
+    foremanThread.wait();
+}
+
 void ArifMainWindow::initialize()
 {
     // Connect widgets that can update settings.
@@ -84,11 +116,18 @@ void ArifMainWindow::initialize()
     connect(signalSigmaSpinbox, SIGNAL(valueChanged(double)), SLOT(updateSettings()));
     connect(cropWidthBox, SIGNAL(valueChanged(int)), SLOT(updateSettings()));
     connect(saveImagesCheck, SIGNAL(toggled(bool)), SLOT(updateSettings()));
+    connect(outputFormatCombo, SIGNAL(currentIndexChanged(int)), SLOT(updateSettings()));
     connect(filterAcceptanceRate, SIGNAL(toggled(bool)), SLOT(updateSettings()));
     connect(minimumQualitySpinbox, SIGNAL(valueChanged(double)), SLOT(updateSettings()));
     connect(acceptanceSpinbox, SIGNAL(valueChanged(int)), SLOT(updateSettings()));
     connect(filterQueueSpinbox, SIGNAL(valueChanged(int)), SLOT(updateSettings()));
     connect(filterCheck, SIGNAL(toggled(bool)), SLOT(updateSettings()));
+    connect(ringRecorderBox, SIGNAL(toggled(bool)), SLOT(updateSettings()));
+    connect(ringSecondsSpinbox, SIGNAL(valueChanged(double)), SLOT(updateSettings()));
+    connect(ringAfterSpinbox, SIGNAL(valueChanged(double)), SLOT(updateSettings()));
+    connect(ringThresholdSpinbox, SIGNAL(valueChanged(double)), SLOT(updateSettings()));
+    connect(ringWindowSpinbox, SIGNAL(valueChanged(int)), SLOT(updateSettings()));
+    connect(acceptanceEntireFileCheck, SIGNAL(toggled(bool)), SLOT(updateSettings()));
     connect(cropWidthButton, SIGNAL(toggled(bool)), videoWidget, SLOT(enableSelection(bool)));
     connect(thresholdButton, SIGNAL(toggled(bool)), videoWidget, SLOT(enableSelection(bool)));
     connect(videoWidget, SIGNAL(selectionComplete(QRect)), SLOT(imageRegionSelected(QRect)));
@@ -100,20 +139,27 @@ void ArifMainWindow::initialize()
     connect(markClippedCheck, SIGNAL(toggled(bool)), SLOT(getFrameToRender()));
     connect(negativeCheck, SIGNAL(toggled(bool)), SLOT(updateSettings()));
 
-    // Prepare the processing pipeline and start displaying frames.
+    connect(displayCheck, SIGNAL(toggled(bool)), SLOT(updateSettings()));
+    connect(displayInterval, SIGNAL(valueChanged(int)), SLOT(updateSettings()));
+
+    // Prepare the processing pipeline. The foreman and the reader get
+    // their own thread, so that frames don't wait for the GUI on their
+    // way to the workers. Only results and statistics come back here.
     foreman.reset(new Foreman);
     updateSettings();
     auto reader = settings.plugin->reader();
-    connect(reader, SIGNAL(frameReady(SharedRawFrame)),
-            foreman.data(), SLOT(takeFrame(SharedRawFrame)));
-    connect(reader, SIGNAL(frameReady(SharedRawFrame)),
-            SLOT(requestRendering()));
-    connect(reader, SIGNAL(frameReady(SharedRawFrame)),
-            SLOT(frameReceived()));
+    bool sequential = reader->isSequential();
+    quint64 frames = sequential ? 0 : reader->numberOfFrames();
+    connect(reader, SIGNAL(framesReady(QVector<SharedRawFrame>)),
+            foreman.data(), SLOT(takeFrames(QVector<SharedRawFrame>)));
+    connect(reader, SIGNAL(atEnd()), foreman.data(), SLOT(inputFinished()));
     connect(reader, SIGNAL(error(QString)), SLOT(readerError(QString)));
     connect(reader, SIGNAL(atEnd()), SLOT(readerFinished()));
-    connect(foreman.data(), SIGNAL(ready()),
-            reader, SLOT(readFrame()));
+    connect(foreman.data(), SIGNAL(selectionFinished()), SLOT(readerFinished()));
+    connect(foreman.data(), SIGNAL(readyForFrames(int)),
+            reader, SLOT(readFrames(int)));
+    connect(foreman.data(), SIGNAL(framesReceived(int, bool)),
+            SLOT(framesReceived(int, bool)));
     connect(foreman.data(),
             SIGNAL(frameProcessed(SharedData)),
             SLOT(frameProcessed(SharedData)));
@@ -121,90 +167,135 @@ void ArifMainWindow::initialize()
             qualityGraph, SLOT(addFrameStats(SharedData)));
     connect(foreman.data(), SIGNAL(frameProcessed(SharedData)),
             qualityHistogram, SLOT(addFrameStats(SharedData)));
-    connect(foreman.data(), SIGNAL(stopped()), SLOT(foremanStopped()));
+    connect(foreman.data(), SIGNAL(frameMissed(qint64)),
+            SLOT(frameMissed(qint64)));
+    connect(foreman.data(), SIGNAL(stopped(bool)), SLOT(foremanStopped()));
+    foreman->moveToThread(&foremanThread);
+    reader->moveToThread(&foremanThread);
+    foremanThread.start();
+
     // Read a frame and render it. If this is a file, go back to beginning.
-    foreman->renderNextFrame();
-    reader->readFrame();
-    if (!reader->isSequential()) {
-        reader->seek(0);
+    QMetaObject::invokeMethod(foreman.data(), "renderNextFrame", Qt::QueuedConnection);
+    QMetaObject::invokeMethod(foreman.data(), "requestFrame", Qt::QueuedConnection);
+    if (!sequential) {
+        QMetaObject::invokeMethod(foreman.data(), "seek", Qt::QueuedConnection,
+                                  Q_ARG(qint64, 0));
         seekSlider->setEnabled(true);
         seekSlider->setMinimum(0);
-        seekSlider->setMaximum(reader->numberOfFrames());
-        connect(reader, SIGNAL(frameReady(SharedRawFrame)), SLOT(incrementSlider()));
-        acceptanceEntireFileCheck->setEnabled(true);
+        seekSlider->setMaximum(frames);
         QString txt = acceptanceEntireFileCheck->text();
         txt += " (" + tr("%1 frames") + ")";
-        txt = txt.arg(reader->numberOfFrames());
+        txt = txt.arg(frames);
         acceptanceEntireFileCheck->setText(txt);
     } else {
         seekSlider->setVisible(false);
+        QString txt = acceptanceEntireFileCheck->text();
+        txt += " (" + tr("until stopped") + ")";
+        acceptanceEntireFileCheck->setText(txt);
     }
+    acceptanceEntireFileCheck->setEnabled(true);
 
     auto fpsTimer = new QTimer(this);
     connect(fpsTimer, SIGNAL(timeout()), SLOT(updateFps()));
     fpsTimer->start(1000 * fpsUpdateSec);
 }
 
-void ArifMainWindow::requestRendering()
-{
-    if (++finishedFrameCounter > displayInterval->value()) {
-        finishedFrameCounter = 0;
-        if (displayCheck->isChecked()) {
-            foreman->renderNextFrame();
-            qualityGraph->draw();
-            qualityHistogram->draw();
-        }
-    }
-}
-
 void ArifMainWindow::frameProcessed(SharedData data)
 {
-    if (data->doRender && data->completedStages.contains(ProcessingStage::Render)) {
-        // Just swap image data with the one currently rendered.
-        videoWidget->unusedFrame()->swap(data->renderedFrame);
-        videoWidget->swapFrames();
-        videoWidget->setDrawnPath(data->paintObjects);
-        bool gray = 1 == data->decoded.channels();
-        histogramWidget->updateHistograms(data->histograms, gray);
+    // Previews of a seekable video are kept, and those rendered ahead
+    // of the seek slider are only shown once it gets there.
+    if (data->onlyRender)
+        previewsRequested.remove(data->frameIndex);
+    if (data->onlyRender && data->frameIndex >= 0 && data->stageSuccessful &&
+        data->completedStages.contains(ProcessingStage::Render)) {
+        if (renderKey(*data->settings) == previewKey)
+            previewCache.insert(data->frameIndex, new SharedData(data),
+                                previewCost(data));
+        if (data->frameIndex != seekSlider->value())
+            return;
     }
+    if (data->doRender && data->completedStages.contains(ProcessingStage::Render))
+        showRenderedFrame(data);
     if (data->stageSuccessful) {
         processedFrames++;
+        latency.add(*data);
         if (data->completedStages.contains(ProcessingStage::EstimateQuality)) {
             if (settings.filterType == QualityFilterType::MinimumQuality
                     && !data->accepted)
                 rejectedFrames++;
-            if (acceptanceEntireFileCheck->isChecked())
-                entireFileQualities << data->quality;
-        }
-        if (data->completedStages.contains(ProcessingStage::Decode)) {
-            if (!thresholdSamplingArea.isEmpty()) {
-                QRect t = thresholdSamplingArea;
-                thresholdSamplingArea = QRect();
-                cv::Rect ct(t.x(), t.y(), t.width(), t.height());
-                cv::Mat_<float> m = data->grayscale(ct);
-                m = m.clone().reshape(1, m.total());
-                std::sort(m.begin(), m.end());
-                // Disregard burnt pixels, so pick the 99% brightest.
-                thresholdSpinbox->setValue(m(.99 * m.total()));
-            }
-            if (!decodedImagePixelSize) {
-                decodedImagePixelSize = data->decoded.elemSize();
-                updateSettings();
-            }
+            if (acceptanceEntireFileCheck->isChecked() &&
+                settings.filterType != QualityFilterType::BestOfAll)
+                entireFileFrames << KnownFrame{data->frameIndex, data->quality,
+                                               data->cropArea};
         }
+        // Only rendered frames carry the decoded image.
+        if (data->completedStages.contains(ProcessingStage::Decode) &&
+            !data->decoded.empty())
+            useDecodedImage(data);
     } else {
         missedFrames++;
     }
 }
 
-void ArifMainWindow::frameReceived()
+void ArifMainWindow::showRenderedFrame(SharedData data)
+{
+    // The image is shared, so that a cached preview keeps it.
+    *videoWidget->unusedFrame() = data->renderedFrame;
+    videoWidget->swapFrames();
+    videoWidget->setDrawnPath(data->paintObjects);
+    bool gray = 1 == data->decoded.channels();
+    histogramWidget->updateHistograms(data->histograms, gray);
+    if (!data->onlyRender) {
+        qualityGraph->draw();
+        qualityHistogram->draw();
+    }
+}
+
+void ArifMainWindow::useDecodedImage(SharedData data)
 {
-    receivedFrames++;
+    if (!thresholdSamplingArea.isEmpty()) {
+        QRect t = thresholdSamplingArea;
+        thresholdSamplingArea = QRect();
+        cv::Rect ct(t.x(), t.y(), t.width(), t.height());
+        // The grayscale image lives only while the frame is being
+        // processed, so make one from the decoded image.
+        cv::Mat region;
+        data->decoded(ct).convertTo(region, CV_32F);
+        if (region.channels() > 1) {
+#if CV_VERSION_MAJOR > 3
+            cv::cvtColor(region, region, cv::COLOR_BGR2GRAY);
+#else
+            cv::cvtColor(region, region, CV_BGR2GRAY);
+#endif
+        }
+        cv::Mat_<float> m = region.reshape(1, region.total());
+        std::sort(m.begin(), m.end());
+        // Disregard burnt pixels, so pick the 99% brightest.
+        thresholdSpinbox->setValue(m(.99 * m.total()));
+    }
+    if (!decodedImagePixelSize) {
+        decodedImagePixelSize = data->decoded.elemSize();
+        updateSettings();
+    }
+}
+
+void ArifMainWindow::framesReceived(int count, bool processing)
+{
+    receivedFrames += count;
+    // Frames read for previews don't advance the position.
+    if (processing && seekSlider->isEnabled()) {
+        seekSlider->blockSignals(true);
+        seekSlider->setValue(seekSlider->value() + count);
+        seekSlider->blockSignals(false);
+    }
 }
 
-void ArifMainWindow::frameMissed()
+void ArifMainWindow::frameMissed(qint64 index)
 {
-    missedFrames++;
+    // A preview that couldn't be rendered can be requested again.
+    previewsRequested.remove(index);
+    if (foreman->isStarted())
+        missedFrames++;
 }
 
 void ArifMainWindow::updateFps()
@@ -218,28 +309,44 @@ void ArifMainWindow::updateFps()
     missedFrames = 0;
     rejectedLabel->setText(QString::number((int)(rejectedFrames / div)));
     rejectedFrames = 0;
+    latencyLabel->setText(latency.summary());
+    latencyLabel->setToolTip(latency.report());
 }
 
 void ArifMainWindow::on_processButton_toggled(bool checked)
 {
-    entireFileQualities.clear();
+    entireFileFrames.clear();
+    entireFilePassDone = false;
     if (checked) {
+        latency.clear();
+        bool indexed = false;
         if (acceptanceEntireFileCheck->isChecked()) {
             seekSlider->setValue(0);
             saveImagesCheck->setChecked(false);
             filterCheck->setChecked(false);
+            // Qualities known from a previous run make the first pass moot.
+            indexed = !settings.plugin->reader()->isSequential() &&
+                      QualityIndex::load(settings.plugin->inputPath, settings,
+                                         &entireFileFrames);
+        }
+        if (seekPending) {
+            seekPending = false;
+            QMetaObject::invokeMethod(foreman.data(), "seek", Qt::QueuedConnection,
+                                      Q_ARG(qint64, seekSlider->value()));
         }
-        foreman->start();
+        if (indexed)
+            nextEntireFilePass();
+        else
+            QMetaObject::invokeMethod(foreman.data(), "start", Qt::QueuedConnection);
     } else {
         processButton->setEnabled(false);
         // Reenable once foreman actually finishes.
-        foreman->stop();
+        QMetaObject::invokeMethod(foreman.data(), "stop", Qt::QueuedConnection);
         qualityGraph->addLine();
         if (batchMode)
             close();
     }
-    bool haveFile = !checked && !settings.plugin->reader()->isSequential();
-    acceptanceEntireFileCheck->setEnabled(haveFile);
+    acceptanceEntireFileCheck->setEnabled(!checked);
 }
 
 void ArifMainWindow::on_imageDestinationButton_clicked(bool checked)
@@ -253,15 +360,49 @@ void ArifMainWindow::on_imageDestinationButton_clicked(bool checked)
 
 void ArifMainWindow::on_seekSlider_valueChanged(int val)
 {
-    auto reader = settings.plugin->reader();
-    foreman->renderNextFrame();
-    reader->seek(val);
-    if (!foreman->isStarted()) {
-        disconnect(reader, SIGNAL(frameReady(SharedRawFrame)), this, SLOT(incrementSlider()));
-        settings.plugin->reader()->readFrame();
-        connect(reader, SIGNAL(frameReady(SharedRawFrame)), SLOT(incrementSlider()));
-        settings.plugin->reader()->seek(val);
+    if (val != previousSeekValue)
+        scrubDirection = val > previousSeekValue ? 1 : -1;
+    previousSeekValue = val;
+    bool started = foreman->isStarted();
+    auto cached = started ? nullptr : previewCache.object(val);
+    if (cached) {
+        // The reader is moved there only when processing starts.
+        showRenderedFrame(*cached);
+        useDecodedImage(*cached);
+        seekPending = true;
+    } else {
+        QMetaObject::invokeMethod(foreman.data(), "renderNextFrame", Qt::QueuedConnection);
+        QMetaObject::invokeMethod(foreman.data(), "seek", Qt::QueuedConnection,
+                                  Q_ARG(qint64, val));
+        if (!started) {
+            QMetaObject::invokeMethod(foreman.data(), "requestFrame", Qt::QueuedConnection);
+            QMetaObject::invokeMethod(foreman.data(), "seek", Qt::QueuedConnection,
+                                      Q_ARG(qint64, val));
+        }
+        seekPending = false;
     }
+    if (!started)
+        prefetchPreviews(val);
+}
+
+// Renders the frames the seek slider is likely to be moved to next.
+void ArifMainWindow::prefetchPreviews(int val)
+{
+    bool requested = false;
+    for (int i = 1; i <= prefetchedPreviews; i++) {
+        qint64 index = val + i * scrubDirection;
+        if (index < 0 || index >= seekSlider->maximum())
+            break;
+        if (previewCache.contains(index) || previewsRequested.contains(index))
+            continue;
+        previewsRequested << index;
+        requested = true;
+        QMetaObject::invokeMethod(foreman.data(), "renderNextFrame", Qt::QueuedConnection);
+        QMetaObject::invokeMethod(foreman.data(), "seek", Qt::QueuedConnection,
+                                  Q_ARG(qint64, index));
+        QMetaObject::invokeMethod(foreman.data(), "requestFrame", Qt::QueuedConnection);
+    }
+    seekPending = seekPending || requested;
 }
 
 void ArifMainWindow::on_acceptanceEntireFileCheck_toggled(bool checked)
@@ -290,7 +431,7 @@ void ArifMainWindow::on_calculateQualityCheck_toggled(bool checked)
         filterCheck->setChecked(false);
         qualityGraph->addLine();
     }
-    acceptanceEntireFileCheck->setEnabled(checked && !settings.plugin->reader()->isSequential());
+    acceptanceEntireFileCheck->setEnabled(checked);
     updateSettings();
 }
 
@@ -336,6 +477,15 @@ void ArifMainWindow::on_exportSettingsButton_clicked(bool checked)
 
 void ArifMainWindow::foremanStopped()
 {
+    if (entireFilePassDone) {
+        entireFilePassDone = false;
+        // Only the first pass sees every frame.
+        if (!filterCheck->isChecked() && !entireFileFrames.isEmpty())
+            QualityIndex::save(settings.plugin->inputPath, settings,
+                               entireFileFrames);
+        nextEntireFilePass();
+        return;
+    }
     processButton->setEnabled(true);
 }
 
@@ -353,30 +503,41 @@ void ArifMainWindow::readerError(QString error)
 
 void ArifMainWindow::readerFinished()
 {
-    if (acceptanceEntireFileCheck->isChecked()) {
-        if (filterCheck->isChecked()) {
-            // Second pass finished.
-            entireFileQualities.clear();
-            filterCheck->setChecked(false);
-            saveImagesCheck->setChecked(false);
-            processButton->setChecked(false);
-        } else {
-            // Start second pass.
-            std::sort(entireFileQualities.begin(), entireFileQualities.end());
-            int acceptance = acceptanceSpinbox->value();
-            int minIdx = entireFileQualities.count() * (100 - acceptance) / 100;
-            float minQuality = entireFileQualities.at(minIdx);
-            filterMinimumQuality->setChecked(true);
-            minimumQualitySpinbox->setValue(minQuality);
-            filterCheck->setChecked(true);
-            saveImagesCheck->setChecked(true);
-            seekSlider->setValue(0);
-        }
+    // A sequential source is filtered in a single pass, by the foreman.
+    bool twoPass = !settings.plugin->reader()->isSequential();
+    if (twoPass && acceptanceEntireFileCheck->isChecked() &&
+        processButton->isChecked()) {
+        // Let the frames of this pass finish before going on.
+        entireFilePassDone = true;
+        QMetaObject::invokeMethod(foreman.data(), "stop", Qt::QueuedConnection);
     } else {
         processButton->setChecked(false);
     }
 }
 
+void ArifMainWindow::nextEntireFilePass()
+{
+    if (filterCheck->isChecked() || entireFileFrames.isEmpty()) {
+        // Second pass finished.
+        entireFileFrames.clear();
+        filterCheck->setChecked(false);
+        saveImagesCheck->setChecked(false);
+        processButton->setChecked(false);
+        return;
+    }
+    // The second pass only reads the accepted frames and saves them. They
+    // are known, so they are accepted regardless of the minimum quality.
+    auto selected = selectBestFrames(entireFileFrames, acceptanceSpinbox->value());
+    entireFileFrames.clear();
+    filterMinimumQuality->setChecked(true);
+    filterCheck->setChecked(true);
+    saveImagesCheck->setChecked(true);
+    QMetaObject::invokeMethod(foreman.data(), "processKnownFrames",
+                              Qt::QueuedConnection,
+                              Q_ARG(QVector<KnownFrame>, selected));
+    QMetaObject::invokeMethod(foreman.data(), "start", Qt::QueuedConnection);
+}
+
 void ArifMainWindow::updateSettings()
 {
     settings.negative = negativeCheck->isChecked();
@@ -389,8 +550,17 @@ void ArifMainWindow::updateSettings()
     settings.estimatorSettings.noiseSigma = noiseSigmaSpinbox->value();
     settings.estimatorSettings.signalSigma = signalSigmaSpinbox->value();
     settings.saveImages = saveImagesCheck->isChecked();
-    imageDestinationBox->setEnabled(!settings.saveImages);
     settings.saveImagesDirectory = imageDestinationDirectory->text();
+    switch (outputFormatCombo->currentIndex()) {
+    case 1:
+        settings.outputFormat = OutputFormat::Ser;
+        break;
+    case 2:
+        settings.outputFormat = OutputFormat::Fits;
+        break;
+    default:
+        settings.outputFormat = OutputFormat::Tiff;
+    }
     if (filterCheck->isChecked()) {
         if (filterMinimumQuality->isChecked()) {
             settings.filterType = QualityFilterType::MinimumQuality;
@@ -402,9 +572,31 @@ void ArifMainWindow::updateSettings()
     } else {
         settings.filterType = QualityFilterType::None;
     }
+    // A sequential source can't be read twice, so every image is kept
+    // until processing stops and only then are the best ones saved.
+    if (acceptanceEntireFileCheck->isChecked() &&
+        settings.plugin->reader()->isSequential()) {
+        settings.saveImages = true;
+        settings.filterType = QualityFilterType::BestOfAll;
+    }
     settings.minimumQuality = minimumQualitySpinbox->value();
     settings.acceptancePercent = acceptanceSpinbox->value();
     settings.filterQueueLength = filterQueueSpinbox->value();
+    settings.ringRecording = ringRecorderBox->isChecked();
+    settings.ringSeconds = ringSecondsSpinbox->value();
+    settings.ringAfterSeconds = ringAfterSpinbox->value();
+    settings.ringTrigger = ringThresholdSpinbox->value();
+    settings.ringWindow = ringWindowSpinbox->value();
+    // Recordings go into the image directory too.
+    imageDestinationBox->setEnabled(!settings.saveImages && !settings.ringRecording);
+    settings.display = displayCheck->isChecked();
+    settings.displayInterval = displayInterval->value();
+    auto key = renderKey(settings);
+    if (key != previewKey) {
+        previewKey = key;
+        previewCache.clear();
+        previewsRequested.clear();
+    }
     // Pick the worst-case: 16-bit color image.
     int mem = decodedImagePixelSize;
     if (settings.doCrop) {
@@ -417,14 +609,9 @@ void ArifMainWindow::updateSettings()
     mem /= 1024*1024;
     memoryLabel->setText(QString("%1 Mb").arg(mem));
     if (foreman)
-        foreman->updateSettings(settings);
-}
-
-void ArifMainWindow::incrementSlider()
-{
-    seekSlider->blockSignals(true);
-    seekSlider->setValue(seekSlider->value() + 1);
-    seekSlider->blockSignals(false);
+        QMetaObject::invokeMethod(foreman.data(), "updateSettings",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(ProcessingSettings, settings));
 }
 
 void ArifMainWindow::imageRegionSelected(QRect region)
@@ -445,8 +632,10 @@ void ArifMainWindow::getFrameToRender()
     if (!foreman->isStarted()) {
         auto reader = settings.plugin->reader();
         if (reader->isSequential()) {
-            foreman->renderNextFrame();
-            reader->readFrame();
+            QMetaObject::invokeMethod(foreman.data(), "renderNextFrame",
+                                      Qt::QueuedConnection);
+            QMetaObject::invokeMethod(foreman.data(), "requestFrame",
+                                      Qt::QueuedConnection);
         } else {
             on_seekSlider_valueChanged(seekSlider->value());
         }
@@ -456,7 +645,7 @@ void ArifMainWindow::getFrameToRender()
 void ArifMainWindow::closeEvent(QCloseEvent* event)
 {
     saveProgramSettings();
-    foreman->stop();
+    QMetaObject::invokeMethod(foreman.data(), "stop", Qt::QueuedConnection);
     while (foreman->isStarted())
         QApplication::processEvents();
     QWidget::closeEvent(event);
@@ -480,6 +669,7 @@ void ArifMainWindow::saveProgramSettings(QString filename)
     config->setValue("processing/negative", negativeCheck->isChecked());
     config->setValue("processing/cropwidth", cropWidthBox->value());
     config->setValue("processing/saveimages", imageDestinationDirectory->text());
+    config->setValue("processing/outputformat", outputFormatCombo->currentIndex());
     config->setValue("processing/noisesigma", noiseSigmaSpinbox->value());
     config->setValue("processing/signalsigma", signalSigmaSpinbox->value());
     config->setValue("processing/threshold", thresholdSpinbox->value());
@@ -491,6 +681,11 @@ void ArifMainWindow::saveProgramSettings(QString filename)
     config->setValue("filtering/minimumquality", minimumQualitySpinbox->value());
     config->setValue("filtering/acceptancerate", acceptanceSpinbox->value());
     config->setValue("filtering/filterqueue", filterQueueSpinbox->value());
+    config->setValue("recorder/enabled", ringRecorderBox->isChecked());
+    config->setValue("recorder/before", ringSecondsSpinbox->value());
+    config->setValue("recorder/after", ringAfterSpinbox->value());
+    config->setValue("recorder/trigger", ringThresholdSpinbox->value());
+    config->setValue("recorder/window", ringWindowSpinbox->value());
     config->setValue("display/shortgraphlength", shortGraphLength->value());
     config->setValue("display/displayenabled", displayCheck->isChecked());
 
@@ -517,6 +712,7 @@ void ArifMainWindow::restoreProgramSettings(QString filename)
     negativeCheck->setChecked(config->value("processing/negative", false).toBool());
     cropWidthBox->setValue(config->value("processing/cropwidth", 100).toInt());
     imageDestinationDirectory->setText(config->value("processing/saveimages").toString());
+    outputFormatCombo->setCurrentIndex(config->value("processing/outputformat", 0).toInt());
     noiseSigmaSpinbox->setValue(config->value("processing/noisesigma", 1.0).toDouble());
     signalSigmaSpinbox->setValue(config->value("processing/signalsigma", 4.0).toDouble());
     thresholdSpinbox->setValue(config->value("processing/threshold", 0.0).toDouble());
@@ -529,6 +725,11 @@ void ArifMainWindow::restoreProgramSettings(QString filename)
     minimumQualitySpinbox->setValue(config->value("filtering/minimumquality", 0.0).toDouble());
     acceptanceSpinbox->setValue(config->value("filtering/acceptancerate", 100).toInt());
     filterQueueSpinbox->setValue(config->value("filtering/filterqueue", 10).toInt());
+    ringRecorderBox->setChecked(config->value("recorder/enabled", false).toBool());
+    ringSecondsSpinbox->setValue(config->value("recorder/before", 5.0).toDouble());
+    ringAfterSpinbox->setValue(config->value("recorder/after", 5.0).toDouble());
+    ringThresholdSpinbox->setValue(config->value("recorder/trigger", 0.0).toDouble());
+    ringWindowSpinbox->setValue(config->value("recorder/window", 10).toInt());
     shortGraphLength->setValue(config->value("display/shortgraphlength", 1000).toInt());
     displayCheck->setChecked(config->value("display/displayenabled", true).toBool());
 
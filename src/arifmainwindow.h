@@ -22,6 +22,10 @@
 #include "videosources/interfaces.h"
 #include "ui_arifmainwindow.h"
 #include "foreman.h"
+#include "latencystats.h"
+#include <QThread>
+#include <QCache>
+#include <QSet>
 
 class ArifMainWindow : public QMainWindow, public Ui::arifMainWindow
 {
@@ -34,19 +38,19 @@ public:
                             QString destinationDir = QString{},
                             QWidget* parent = 0,
                             Qt::WindowFlags flags = Qt::Widget);
+    ~ArifMainWindow();
 
 private slots:
     void initialize();
-    void requestRendering();
     void frameProcessed(SharedData data);
-    void frameReceived();
-    void frameMissed();
+    void framesReceived(int count, bool processing);
+    void frameMissed(qint64 index);
     void updateFps();
     void foremanStopped();
     void readerError(QString error);
     void readerFinished();
+    void nextEntireFilePass();
     void updateSettings();
-    void incrementSlider();
     void imageRegionSelected(QRect region);
     void getFrameToRender();
 
@@ -64,18 +68,33 @@ private:
     void closeEvent(QCloseEvent* event);
     void saveProgramSettings(QString filename = QString{});
     void restoreProgramSettings(QString filename = QString{});
+    void showRenderedFrame(SharedData data);
+    void useDecodedImage(SharedData data);
+    void prefetchPreviews(int val);
 
 private:
     ProcessingSettings settings;
+    QThread foremanThread;
     QScopedPointer<Foreman> foreman;
-    int finishedFrameCounter = 0;
-    QList<float> entireFileQualities;
+    // Frames seen by the first pass of filtering the entire file.
+    QVector<KnownFrame> entireFileFrames;
+    // A pass is done once the foreman has stopped.
+    bool entireFilePassDone = false;
+    // Rendered previews of a seekable video by frame index, so that
+    // scrubbing doesn't read and decode the same frames again.
+    QCache<qint64, SharedData> previewCache;
+    QByteArray previewKey; // Render settings of the cached previews.
+    QSet<qint64> previewsRequested;
+    int previousSeekValue = 0, scrubDirection = 1;
+    // The reader is not at the frame shown by the seek slider.
+    bool seekPending = false;
     QRect thresholdSamplingArea;
     int decodedImagePixelSize = 0;
     uint receivedFrames = 0;
     uint processedFrames = 0;
     uint missedFrames = 0;
     uint rejectedFrames = 0;
+    LatencyStats latency;
     bool batchMode;
     QWidget* sourceControl;
 };
@@ -0,0 +1,162 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resultsformat.h"
+#include "videosources/mappedfile.h"
+#include <tclap/CmdLine.h>
+#include <QDateTime>
+#include <QStringList>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+struct Value {
+    double value;
+    const Results::Chunk* chunk;
+    int row;
+};
+
+static bool findColumn(const std::string& name, Results::Column* column)
+{
+    for (int c = 0; c < Results::ColumnCount; c++) {
+        if (name == Results::columnName(Results::Column(c))) {
+            *column = Results::Column(c);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void printRow(const Results::Chunk& chunk, int row, double value)
+{
+    using namespace Results;
+    auto time = QDateTime::fromMSecsSinceEpoch(chunk.value(Timestamp, row));
+    std::cout << qint64(chunk.value(Sequence, row)) << '\t'
+              << qint64(chunk.value(FrameIndex, row)) << '\t'
+              << time.toUTC().toString(Qt::ISODateWithMs).toStdString() << '\t'
+              << chunk.value(Quality, row) << '\t'
+              << value << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string filename, columnName;
+    QStringList percentiles;
+    int top;
+    bool onlyAccepted;
+    try {
+        const char description[] =
+            "Queries the results log that arif writes into its destination "
+            "directory. "
+            "By default, percentiles of the frame quality are printed. "
+            "Other columns can be chosen with --column, they are: "
+            "sequence, frame, timestamp, frameofsecond, quality, "
+            "centroidx, centroidy, cropx, cropy, cropwidth, cropheight, "
+            "accepted and the per-stage times in microseconds decodetime, "
+            "rendertime, croptime, estimatetime and savetime. The --top "
+            "option lists the sequence number, frame index, timestamp and "
+            "quality of the frames with the highest values instead.";
+        TCLAP::CmdLine cmd(description);
+        TCLAP::UnlabeledValueArg<std::string>
+        fileArg("log", "Results log", true, std::string{}, "file", cmd);
+        TCLAP::ValueArg<std::string>
+        columnArg("c", "column", "Column to query", false, "quality",
+                  "name", cmd);
+        TCLAP::ValueArg<std::string>
+        percentilesArg("p", "percentiles", "Comma-separated percentiles",
+                       false, "5,25,50,75,95", "list", cmd);
+        TCLAP::ValueArg<int>
+        topArg("t", "top", "Number of frames with the highest values to list",
+               false, 0, "number", cmd);
+        TCLAP::SwitchArg
+        acceptedArg("a", "accepted", "Only consider accepted frames", cmd);
+        cmd.parse(argc, argv);
+        filename = fileArg.getValue();
+        columnName = columnArg.getValue();
+        percentiles = QString::fromStdString(percentilesArg.getValue())
+                      .split(',', QString::SkipEmptyParts);
+        top = topArg.getValue();
+        onlyAccepted = acceptedArg.getValue();
+    } catch (TCLAP::ArgException &e) {
+        std::cerr << "Error processing argument " << e.argId() << std::endl
+                  << e.error() << std::endl;
+        return 1;
+    }
+
+    Results::Column column;
+    if (!findColumn(columnName, &column)) {
+        std::cerr << "Error: unknown column " << columnName << std::endl;
+        return 1;
+    }
+    // The log is read in place, only the queried columns are paged in.
+    MappedFile file(QString::fromStdString(filename));
+    if (!file.isValid()) {
+        std::cerr << "Error: cannot read " << filename << std::endl;
+        return 1;
+    }
+    QVector<Results::Chunk> chunks;
+    auto error = Results::parse(file.data(), file.size(), &chunks);
+    if (!error.isEmpty()) {
+        std::cerr << "Error: " << error.toStdString() << std::endl;
+        return 1;
+    }
+
+    std::vector<Value> values;
+    for (auto& chunk : chunks) {
+        auto accepted = chunk.column<quint8>(Results::Accepted);
+        for (int i = 0; i < chunk.rows; i++)
+            if (!onlyAccepted || accepted[i])
+                values.push_back({chunk.value(column, i), &chunk, i});
+    }
+    if (values.empty()) {
+        std::cerr << "No frames in the log." << std::endl;
+        return 1;
+    }
+    auto higher = [](const Value& a, const Value& b) {
+        return a.value > b.value;
+    };
+
+    if (top > 0) {
+        auto end = values.begin() + std::min<size_t>(top, values.size());
+        std::partial_sort(values.begin(), end, values.end(), higher);
+        std::cout << "sequence\tframe\ttimestamp\tquality\t" << columnName
+                  << std::endl;
+        for (auto v = values.begin(); v != end; ++v)
+            printRow(*v->chunk, v->row, v->value);
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end(),
+              [](const Value& a, const Value& b) { return a.value < b.value; });
+    std::cout << values.size() << " frames" << std::endl;
+    for (auto& p : percentiles) {
+        bool ok;
+        double percent = p.toDouble(&ok);
+        if (!ok || percent < 0 || percent > 100) {
+            std::cerr << "Error: invalid percentile " << p.toStdString()
+                      << std::endl;
+            return 1;
+        }
+        size_t rank = std::lround(percent / 100 * (values.size() - 1));
+        std::cout << std::setw(6) << percent << "%\t" << values[rank].value
+                  << std::endl;
+    }
+    return 0;
+}
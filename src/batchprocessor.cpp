@@ -0,0 +1,207 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "batchprocessor.h"
+#include "qualityindex.h"
+#include "bufferpool.h"
+#include <QSettings>
+#include <QDebug>
+#include <iostream>
+
+static const int progressStep = 5; // Percent.
+
+BatchProcessor::BatchProcessor(VideoSourcePlugin* plugin, QString settingsFile,
+                               QString destinationDir, QObject* parent):
+    QObject(parent)
+{
+    settings.plugin = plugin;
+    loadSettings(settingsFile);
+    settings.saveImagesDirectory = destinationDir;
+
+    foreman.reset(new Foreman);
+    auto reader = plugin->reader();
+    connect(reader, SIGNAL(framesReady(QVector<SharedRawFrame>)),
+            foreman.data(), SLOT(takeFrames(QVector<SharedRawFrame>)));
+    connect(reader, SIGNAL(atEnd()), foreman.data(), SLOT(inputFinished()));
+    connect(reader, SIGNAL(error(QString)), SLOT(readerError(QString)));
+    connect(reader, SIGNAL(atEnd()), SLOT(readerFinished()));
+    connect(foreman.data(), SIGNAL(selectionFinished()), SLOT(readerFinished()));
+    connect(foreman.data(), SIGNAL(readyForFrames(int)),
+            reader, SLOT(readFrames(int)));
+    connect(foreman.data(), SIGNAL(frameProcessed(SharedData)),
+            SLOT(frameProcessed(SharedData)));
+    connect(foreman.data(), SIGNAL(stopped(bool)), SLOT(foremanStopped(bool)));
+    foreman->moveToThread(&foremanThread);
+    reader->moveToThread(&foremanThread);
+    foremanThread.start();
+}
+
+BatchProcessor::~BatchProcessor()
+{
+    foremanThread.quit();
+    foremanThread.wait();
+}
+
+// Same keys as the main window uses.
+void BatchProcessor::loadSettings(QString settingsFile)
+{
+    QScopedPointer<QSettings> config;
+    if (settingsFile.isEmpty())
+        config.reset(new QSettings);
+    else
+        config.reset(new QSettings(settingsFile, QSettings::IniFormat));
+
+    settings.negative = config->value("processing/negative", false).toBool();
+    settings.doCrop = config->value("processing/crop", true).toBool();
+    settings.cropWidth = config->value("processing/cropwidth", 100).toInt();
+    settings.threshold = config->value("processing/threshold", 0.0).toDouble();
+    settings.markClipped = false;
+    settings.logarithmicHistograms = false;
+    settings.estimateQuality = true;
+    settings.estimatorSettings.noiseSigma =
+        config->value("processing/noisesigma", 1.0).toDouble();
+    settings.estimatorSettings.signalSigma =
+        config->value("processing/signalsigma", 4.0).toDouble();
+    switch (config->value("processing/outputformat", 0).toInt()) {
+    case 1:
+        settings.outputFormat = OutputFormat::Ser;
+        break;
+    case 2:
+        settings.outputFormat = OutputFormat::Fits;
+        break;
+    default:
+        settings.outputFormat = OutputFormat::Tiff;
+    }
+    settings.acceptancePercent = config->value("filtering/acceptancerate", 100).toInt();
+    settings.filterQueueLength = config->value("filtering/filterqueue", 10).toInt();
+    settings.ringRecording = false;
+    settings.display = false;
+    settings.displayInterval = 0;
+}
+
+void BatchProcessor::start()
+{
+    pass = 1;
+    frames.clear();
+    settings.saveImages = false;
+    settings.filterType = QualityFilterType::None;
+    settings.minimumQuality = 0;
+    // A sequential input can't be read twice, so the foreman keeps all
+    // images and saves the best ones when stopped.
+    if (settings.plugin->reader()->isSequential()) {
+        settings.saveImages = true;
+        settings.filterType = QualityFilterType::BestOfAll;
+    } else if (QualityIndex::load(settings.plugin->inputPath, settings,
+                                  &frames)) {
+        std::cout << "Using the quality index of a previous run." << std::endl;
+        startSecondPass();
+        return;
+    }
+    startPass();
+}
+
+void BatchProcessor::startPass()
+{
+    processedFrames = 0;
+    reportedPercent = -progressStep;
+    auto reader = settings.plugin->reader();
+    if (pass == 2)
+        totalFrames = selected.size();
+    else if (!reader->isSequential())
+        totalFrames = reader->numberOfFrames();
+    else
+        totalFrames = 0;
+    QMetaObject::invokeMethod(foreman.data(), "updateSettings", Qt::QueuedConnection,
+                              Q_ARG(ProcessingSettings, settings));
+    // A sequential input is read as it comes, until its end.
+    if (pass == 2)
+        QMetaObject::invokeMethod(foreman.data(), "processKnownFrames",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(QVector<KnownFrame>, selected));
+    else if (!reader->isSequential())
+        QMetaObject::invokeMethod(foreman.data(), "seek", Qt::QueuedConnection,
+                                  Q_ARG(qint64, 0));
+    QMetaObject::invokeMethod(foreman.data(), "start", Qt::QueuedConnection);
+}
+
+void BatchProcessor::frameProcessed(SharedData data)
+{
+    processedFrames++;
+    if (data->stageSuccessful)
+        latency.add(*data);
+    if (totalFrames > 0) {
+        int percent = qMin<qint64>(100, 100 * processedFrames / totalFrames);
+        if (percent >= reportedPercent + progressStep) {
+            reportedPercent = percent;
+            std::cout << "Pass " << pass << ": " << percent << "%" << std::endl;
+        }
+    }
+    if (pass == 1 && settings.filterType == QualityFilterType::None &&
+        data->stageSuccessful &&
+        data->completedStages.contains(ProcessingStage::EstimateQuality))
+        frames << KnownFrame{data->frameIndex, data->quality, data->cropArea};
+}
+
+void BatchProcessor::readerError(QString error)
+{
+    qDebug() << "Video source error:" << error;
+    failed = true;
+    QMetaObject::invokeMethod(foreman.data(), "stop", Qt::QueuedConnection);
+}
+
+void BatchProcessor::readerFinished()
+{
+    // Frames still being processed are waited for.
+    QMetaObject::invokeMethod(foreman.data(), "stop", Qt::QueuedConnection);
+}
+
+void BatchProcessor::foremanStopped(bool saved)
+{
+    if (!saved)
+        failed = true;
+    if (pass == 1 && !failed &&
+        settings.filterType == QualityFilterType::None) {
+        if (frames.isEmpty()) {
+            qDebug() << "No frames could be processed.";
+            failed = true;
+        } else {
+            QualityIndex::save(settings.plugin->inputPath, settings, frames);
+            startSecondPass();
+            return;
+        }
+    }
+    if (latency.count() > 0) {
+        std::cout << latency.report().toStdString() << std::endl;
+        auto stats = BufferPool::instance()->statistics();
+        std::cout << "Buffer pool: " << stats.hits << " hits, "
+                  << stats.misses << " misses, " << stats.dropped
+                  << " dropped" << std::endl;
+    }
+    emit finished(failed ? 1 : 0);
+}
+
+void BatchProcessor::startSecondPass()
+{
+    selected = selectBestFrames(frames, settings.acceptancePercent);
+    frames.clear();
+    pass = 2;
+    // Only the selected frames are read, and all of them are accepted.
+    settings.saveImages = true;
+    settings.filterType = QualityFilterType::MinimumQuality;
+    startPass();
+}
@@ -0,0 +1,79 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include "videosources/interfaces.h"
+#include "foreman.h"
+#include "latencystats.h"
+#include <QThread>
+
+/*
+ * Processes an entire video without a GUI, for use on the command line.
+ * The first pass estimates the quality of every frame, the second one
+ * reads only the frames that are within the acceptance rate and saves
+ * them, reusing their crop and quality. The first pass is skipped if
+ * a quality index of a previous run matches the input. Inputs that can't be sought
+ * are processed in a single pass that keeps all images until the end.
+ * It needs only a QCoreApplication, so it runs on machines without a
+ * display.
+ */
+class BatchProcessor: public QObject
+{
+    Q_OBJECT
+
+public:
+    // Processing settings are read from the settings file, or from the
+    // ones of the GUI if it is empty.
+    BatchProcessor(VideoSourcePlugin* plugin, QString settingsFile,
+                   QString destinationDir, QObject* parent = 0);
+    ~BatchProcessor();
+
+public slots:
+    void start();
+
+signals:
+    // Emitted when both passes are done, status is nonzero on error.
+    void finished(int status);
+
+private slots:
+    void frameProcessed(SharedData data);
+    void readerError(QString error);
+    void readerFinished();
+    void foremanStopped(bool saved);
+
+private:
+    void loadSettings(QString settingsFile);
+    void startPass();
+    void startSecondPass();
+
+    ProcessingSettings settings;
+    QThread foremanThread;
+    QScopedPointer<Foreman> foreman;
+    QVector<KnownFrame> frames; // Seen by the first pass.
+    QVector<KnownFrame> selected;
+    int pass = 0;
+    bool failed = false;
+    // Progress of the current pass.
+    qint64 totalFrames = 0, processedFrames = 0;
+    int reportedPercent = 0;
+    LatencyStats latency;
+};
+
+#endif
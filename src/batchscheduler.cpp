@@ -0,0 +1,144 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "batchscheduler.h"
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QDir>
+#include <QSet>
+#include <QThread>
+#include <iostream>
+
+BatchScheduler::BatchScheduler(QStringList inputs, QString destinationDir,
+                               int jobs_, QStringList arguments_,
+                               QObject* parent):
+    QObject(parent), arguments(arguments_), maxRunning(qMax(jobs_, 1))
+{
+    QDir destination(destinationDir);
+    QSet<QString> used;
+    for (auto& input : inputs) {
+        auto name = QFileInfo(input).completeBaseName();
+        if (name.isEmpty())
+            name = QFileInfo(input).fileName();
+        auto unique = name;
+        for (int i = 2; used.contains(unique); i++)
+            unique = QString("%1-%2").arg(name).arg(i);
+        used << unique;
+        Job job;
+        job.input = input;
+        job.destination = destination.absoluteFilePath(unique);
+        jobs << job;
+    }
+    // Instances share the processors instead of each using all of them.
+    if (!arguments.contains("--threads")) {
+        int instances = qMax(qMin(maxRunning, jobs.size()), 1);
+        int threads = qMax(1, QThread::idealThreadCount() / instances);
+        arguments << "--threads" << QString::number(threads);
+    }
+}
+
+void BatchScheduler::start()
+{
+    schedule();
+}
+
+void BatchScheduler::schedule()
+{
+    while (running < maxRunning && next < jobs.size())
+        startNext();
+    if (running == 0) {
+        std::cout << jobs.size() - failed << " of " << jobs.size()
+                  << " inputs processed successfully." << std::endl;
+        emit finished(failed ? 1 : 0);
+    }
+}
+
+void BatchScheduler::startNext()
+{
+    auto& job = jobs[next++];
+    if (!QDir().mkpath(job.destination)) {
+        std::cout << "[" << job.input.toStdString() << "] "
+                  << "Error: cannot create " << job.destination.toStdString()
+                  << std::endl;
+        failed++;
+        return;
+    }
+    job.process = new QProcess(this);
+    job.process->setProcessChannelMode(QProcess::MergedChannels);
+    connect(job.process, SIGNAL(readyRead()), SLOT(printOutput()));
+    connect(job.process, SIGNAL(finished(int, QProcess::ExitStatus)),
+            SLOT(jobFinished(int, QProcess::ExitStatus)));
+    connect(job.process, SIGNAL(error(QProcess::ProcessError)),
+            SLOT(jobError(QProcess::ProcessError)));
+    QStringList args = arguments;
+    args << "--input" << job.input << "--output" << job.destination;
+    job.process->start(QCoreApplication::applicationFilePath(), args);
+    running++;
+    std::cout << "[" << job.input.toStdString() << "] started ("
+              << next << "/" << jobs.size() << ")" << std::endl;
+}
+
+BatchScheduler::Job* BatchScheduler::jobOf(QObject* process)
+{
+    for (auto& job : jobs)
+        if (job.process == process)
+            return &job;
+    return nullptr;
+}
+
+void BatchScheduler::printOutput()
+{
+    auto job = jobOf(sender());
+    if (!job)
+        return;
+    job->pendingOutput += job->process->readAll();
+    int end;
+    while ((end = job->pendingOutput.indexOf('\n')) >= 0) {
+        auto line = job->pendingOutput.left(end);
+        job->pendingOutput.remove(0, end + 1);
+        std::cout << "[" << job->input.toStdString() << "] "
+                  << line.constData() << std::endl;
+    }
+}
+
+void BatchScheduler::jobError(QProcess::ProcessError error)
+{
+    // Otherwise, the finished() signal follows.
+    if (error == QProcess::FailedToStart)
+        jobFinished(-1, QProcess::CrashExit);
+}
+
+void BatchScheduler::jobFinished(int exitCode, QProcess::ExitStatus status)
+{
+    auto job = jobOf(sender());
+    if (!job)
+        return;
+    printOutput();
+    if (!job->pendingOutput.isEmpty())
+        std::cout << "[" << job->input.toStdString() << "] "
+                  << job->pendingOutput.constData() << std::endl;
+    bool ok = status == QProcess::NormalExit && exitCode == 0;
+    if (!ok)
+        failed++;
+    std::cout << "[" << job->input.toStdString() << "] "
+              << (ok ? "finished" : "failed") << std::endl;
+    job->process->deleteLater();
+    job->process = nullptr;
+    running--;
+    schedule();
+}
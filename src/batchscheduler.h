@@ -0,0 +1,74 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCHSCHEDULER_H
+#define BATCHSCHEDULER_H
+
+#include <QObject>
+#include <QStringList>
+#include <QProcess>
+#include <QList>
+
+/*
+ * Processes many inputs by running a batch processing instance of arif
+ * for each, several at a time. While one instance waits for its input,
+ * the others keep the processors busy. Each input gets its own directory
+ * in the output directory, and the output of the instances is printed
+ * with the input name in front of every line.
+ */
+class BatchScheduler: public QObject
+{
+    Q_OBJECT
+
+public:
+    // The arguments are passed to every instance along with the input
+    // and output options. Unless they set the number of threads, the
+    // processors are divided among the instances running at a time.
+    BatchScheduler(QStringList inputs, QString destinationDir, int jobs,
+                   QStringList arguments, QObject* parent = 0);
+
+public slots:
+    void start();
+
+signals:
+    // Emitted when all inputs are done, status is nonzero if any failed.
+    void finished(int status);
+
+private slots:
+    void printOutput();
+    void jobFinished(int exitCode, QProcess::ExitStatus status);
+    void jobError(QProcess::ProcessError error);
+
+private:
+    struct Job {
+        QString input, destination;
+        QProcess* process = nullptr;
+        QByteArray pendingOutput;
+    };
+
+    void schedule();
+    void startNext();
+    Job* jobOf(QObject* process);
+
+    QList<Job> jobs;
+    QStringList arguments;
+    int maxRunning;
+    int next = 0, running = 0, failed = 0;
+};
+
+#endif
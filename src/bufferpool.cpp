@@ -0,0 +1,274 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bufferpool.h"
+#include <new>
+#include <utility>
+#include <cstdlib>
+#include <cstdint>
+extern "C" {
+#include <sys/mman.h>
+}
+
+// Blocks smaller than this come straight from the system allocator.
+static const size_t poolThreshold = 64 * 1024;
+static const size_t pageSize = 4096;
+static const size_t hugePageSize = 2 * 1024 * 1024;
+
+static size_t roundUp(size_t bytes, size_t multiple)
+{
+    return (bytes + multiple - 1) / multiple * multiple;
+}
+
+BufferPool* BufferPool::instance()
+{
+    static BufferPool pool;
+    return &pool;
+}
+
+BufferPool::BufferPool()
+{
+    for (auto& c : classes) {
+        for (auto& slot : c.slots)
+            slot.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+void BufferPool::setHugePages(bool enable)
+{
+    hugePages = enable;
+}
+
+void BufferPool::setLimit(size_t bytes)
+{
+    limit = bytes;
+}
+
+BufferPool::Statistics BufferPool::statistics() const
+{
+    return {hits.load(), misses.load(), dropped.load(), cachedBytes.load()};
+}
+
+size_t BufferPool::blockSize(size_t bytes)
+{
+    if (bytes < poolThreshold)
+        return roundUp(bytes, alignment);
+    else if (hugePages && bytes >= hugePageSize)
+        return roundUp(bytes, hugePageSize);
+    else
+        return roundUp(bytes, pageSize);
+}
+
+bool BufferPool::isHuge(size_t blockBytes)
+{
+    return hugePages && blockBytes >= hugePageSize;
+}
+
+void* BufferPool::allocateBlock(size_t blockBytes)
+{
+    if (isHuge(blockBytes)) {
+        // Over-allocate so that the block can be aligned to a huge page,
+        // then give back the unused head and tail.
+        size_t mapped = blockBytes + hugePageSize;
+        void* p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+        auto start = reinterpret_cast<uintptr_t>(p);
+        auto aligned = roundUp(start, hugePageSize);
+        if (aligned > start)
+            munmap(p, aligned - start);
+        size_t tail = start + mapped - (aligned + blockBytes);
+        if (tail > 0)
+            munmap(reinterpret_cast<void*>(aligned + blockBytes), tail);
+        void* block = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+        madvise(block, blockBytes, MADV_HUGEPAGE);
+#endif
+        return block;
+    } else {
+        void* p = nullptr;
+        if (posix_memalign(&p, alignment, blockBytes) != 0)
+            throw std::bad_alloc();
+        return p;
+    }
+}
+
+void BufferPool::freeBlock(void* ptr, size_t blockBytes)
+{
+    if (isHuge(blockBytes))
+        munmap(ptr, blockBytes);
+    else
+        std::free(ptr);
+}
+
+// Finds the class of the given block size. Unused classes are claimed for
+// new sizes; once all are claimed, blocks of other sizes are not pooled.
+BufferPool::SizeClass* BufferPool::sizeClass(size_t blockBytes, bool create)
+{
+    for (auto& c : classes) {
+        size_t size = c.blockBytes.load(std::memory_order_acquire);
+        if (size == blockBytes)
+            return &c;
+        if (size == 0) {
+            if (!create)
+                return nullptr;
+            if (c.blockBytes.compare_exchange_strong(size, blockBytes) ||
+                size == blockBytes)
+                return &c;
+        }
+    }
+    return nullptr;
+}
+
+void* BufferPool::acquire(size_t bytes)
+{
+    size_t block = blockSize(bytes);
+    if (block < poolThreshold)
+        return allocateBlock(block);
+    auto c = sizeClass(block, false);
+    if (c) {
+        for (auto& slot : c->slots) {
+            if (slot.load(std::memory_order_relaxed) == nullptr)
+                continue;
+            void* p = slot.exchange(nullptr, std::memory_order_acquire);
+            if (p) {
+                cachedBytes -= block;
+                hits++;
+                return p;
+            }
+        }
+    }
+    misses++;
+    return allocateBlock(block);
+}
+
+void BufferPool::release(void* ptr, size_t bytes)
+{
+    if (!ptr)
+        return;
+    size_t block = blockSize(bytes);
+    if (block < poolThreshold) {
+        freeBlock(ptr, block);
+        return;
+    }
+    // Reserve room under the limit first, so that it is never exceeded.
+    if (cachedBytes.fetch_add(block) + block <= limit) {
+        if (auto c = sizeClass(block, true)) {
+            for (auto& slot : c->slots) {
+                void* expected = nullptr;
+                if (slot.compare_exchange_strong(expected, ptr,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed))
+                    return;
+            }
+        }
+    }
+    cachedBytes -= block;
+    dropped++;
+    freeBlock(ptr, block);
+}
+
+PooledMatAllocator* PooledMatAllocator::instance()
+{
+    static PooledMatAllocator allocator;
+    return &allocator;
+}
+
+// Mirrors cv::StdMatAllocator, but takes memory from the BufferPool.
+cv::UMatData* PooledMatAllocator::allocate(int dims, const int* sizes, int type,
+                                           void* data0, size_t* step,
+                                           AccessFlag, cv::UMatUsageFlags) const
+{
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+            if (data0 && step[i] != CV_AUTOSTEP) {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            } else {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+    uchar* data = data0 ? static_cast<uchar*>(data0) :
+                  static_cast<uchar*>(BufferPool::instance()->acquire(total));
+    auto u = new cv::UMatData(this);
+    u->data = u->origdata = data;
+    u->size = total;
+    if (data0)
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+    return u;
+}
+
+bool PooledMatAllocator::allocate(cv::UMatData* u, AccessFlag,
+                                  cv::UMatUsageFlags) const
+{
+    return u != nullptr;
+}
+
+void PooledMatAllocator::deallocate(cv::UMatData* u) const
+{
+    if (!u)
+        return;
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+        BufferPool::instance()->release(u->origdata, u->size);
+        u->origdata = nullptr;
+    }
+    delete u;
+}
+
+FrameBuffer::FrameBuffer(size_t bytes)
+{
+    resize(bytes);
+}
+
+FrameBuffer::~FrameBuffer()
+{
+    BufferPool::instance()->release(ptr, bytes);
+}
+
+FrameBuffer::FrameBuffer(FrameBuffer&& other):
+    ptr(other.ptr), bytes(other.bytes)
+{
+    other.ptr = nullptr;
+    other.bytes = 0;
+}
+
+FrameBuffer& FrameBuffer::operator=(FrameBuffer&& other)
+{
+    std::swap(ptr, other.ptr);
+    std::swap(bytes, other.bytes);
+    return *this;
+}
+
+void FrameBuffer::resize(size_t newBytes)
+{
+    if (newBytes == bytes)
+        return;
+    BufferPool::instance()->release(ptr, bytes);
+    ptr = nullptr;
+    bytes = 0;
+    if (newBytes > 0) {
+        ptr = static_cast<char*>(BufferPool::instance()->acquire(newBytes));
+        bytes = newBytes;
+    }
+}
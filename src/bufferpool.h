@@ -0,0 +1,131 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QtGlobal>
+#include <opencv2/core/core.hpp>
+#include <atomic>
+#include <cstddef>
+
+/*
+ * A process-wide pool of 64-byte aligned memory blocks. Large blocks are
+ * not returned to the system when released, but kept in per-size free lists
+ * and handed out again, so that once processing is warmed up, frame-sized
+ * allocations never reach the system allocator. Blocks of 2 MiB or more can
+ * be backed by transparent huge pages to reduce TLB misses on large frames.
+ *
+ * The pool is thread safe and lock-free. Each block size gets a fixed
+ * number of slots that are taken and filled with atomic exchanges, so the
+ * number of cached blocks is bounded both by the slots and by the memory
+ * limit; blocks that don't fit are freed immediately.
+ */
+class BufferPool
+{
+public:
+    struct Statistics {
+        quint64 hits;    // Acquired blocks that were reused.
+        quint64 misses;  // Acquired blocks that had to be allocated.
+        quint64 dropped; // Released blocks that were freed, pool being full.
+        size_t cachedBytes;
+    };
+
+    static BufferPool* instance();
+
+    void* acquire(size_t bytes);
+    // The size must be the same as the one given to acquire().
+    void release(void* ptr, size_t bytes);
+
+    // Call these before the first allocation.
+    void setHugePages(bool enable);
+    void setLimit(size_t bytes); // Maximum amount of memory kept for reuse.
+
+    Statistics statistics() const;
+
+    static const size_t alignment = 64;
+
+private:
+    static const int sizeClassCount = 32;
+    static const int slotsPerClass = 64;
+
+    struct SizeClass {
+        std::atomic<size_t> blockBytes{0}; // 0 while the class is unused.
+        std::atomic<void*> slots[slotsPerClass];
+    };
+
+    BufferPool();
+    size_t blockSize(size_t bytes);
+    bool isHuge(size_t blockBytes);
+    void* allocateBlock(size_t blockBytes);
+    void freeBlock(void* ptr, size_t blockBytes);
+    SizeClass* sizeClass(size_t blockBytes, bool create);
+
+    SizeClass classes[sizeClassCount];
+    std::atomic<size_t> cachedBytes{0};
+    std::atomic<size_t> limit{1024ul * 1024 * 1024};
+    std::atomic<quint64> hits{0}, misses{0}, dropped{0};
+    bool hugePages = false;
+};
+
+// Makes cv::Mat use the BufferPool. Install with cv::Mat::setDefaultAllocator().
+class PooledMatAllocator: public cv::MatAllocator
+{
+public:
+#if CV_VERSION_MAJOR > 3
+    typedef cv::AccessFlag AccessFlag;
+#else
+    typedef int AccessFlag;
+#endif
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type,
+                           void* data, size_t* step, AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const;
+    bool allocate(cv::UMatData* data, AccessFlag accessflags,
+                  cv::UMatUsageFlags usageFlags) const;
+    void deallocate(cv::UMatData* data) const;
+
+    static PooledMatAllocator* instance();
+};
+
+// A raw frame buffer taken from the BufferPool. It can be moved, but not
+// copied, to make copying of frame data explicit.
+class FrameBuffer
+{
+public:
+    FrameBuffer() {}
+    explicit FrameBuffer(size_t bytes);
+    ~FrameBuffer();
+    FrameBuffer(FrameBuffer&& other);
+    FrameBuffer& operator=(FrameBuffer&& other);
+    FrameBuffer(const FrameBuffer&) = delete;
+    FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+    char* data() { return ptr; }
+    const char* constData() const { return ptr; }
+    size_t size() const { return bytes; }
+
+    // Contents are not preserved.
+    void resize(size_t newBytes);
+
+private:
+    char* ptr = nullptr;
+    size_t bytes = 0;
+};
+
+#endif
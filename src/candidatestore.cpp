@@ -0,0 +1,154 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "candidatestore.h"
+#include <cstring>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+std::atomic<size_t> CandidateStore::defaultLimit{512ul * 1024 * 1024};
+
+void CandidateStore::setDefaultMemoryLimit(size_t bytes)
+{
+    defaultLimit = bytes;
+}
+
+size_t CandidateStore::defaultMemoryLimit()
+{
+    return defaultLimit;
+}
+
+CandidateStore::CandidateStore(size_t limit): memoryLimit(limit) {}
+
+bool CandidateStore::add(const cv::Mat& image, const Candidate& c)
+{
+    cv::Mat continuous = image.isContinuous() ? image : image.clone();
+    int rawBytes = continuous.total() * continuous.elemSize();
+    auto raw = reinterpret_cast<const char*>(continuous.data);
+    Entry e;
+    e.info = c;
+    e.rows = continuous.rows;
+    e.cols = continuous.cols;
+    e.type = continuous.type();
+    e.compressed = false;
+#ifdef HAVE_LZ4
+    QByteArray packed(LZ4_compressBound(rawBytes), Qt::Uninitialized);
+    int n = LZ4_compress_default(raw, packed.data(), rawBytes, packed.size());
+    if (n > 0 && n < rawBytes) {
+        packed.resize(n);
+        packed.squeeze();
+        e.data = packed;
+        e.compressed = true;
+    }
+#endif
+    if (!e.compressed)
+        e.data = QByteArray(raw, rawBytes);
+    e.storedBytes = e.data.size();
+
+    // Images to be spilled are taken out under the lock, but written
+    // outside of it, so that other workers can keep adding meanwhile.
+    QVector<int> victims;
+    mutex.lock();
+    inMemory.push(Ranked(c.quality, entries.size()));
+    memoryUsed += e.storedBytes;
+    entries.append(e);
+    while (memoryUsed > memoryLimit && !inMemory.empty()) {
+        int i = inMemory.top().second;
+        inMemory.pop();
+        memoryUsed -= entries.at(i).storedBytes;
+        victims << i;
+    }
+    mutex.unlock();
+    return victims.isEmpty() || spill(victims);
+}
+
+// Moves the images of the given entries from memory to the spill file.
+// They stay in memory until written, so they can be loaded meanwhile.
+bool CandidateStore::spill(const QVector<int>& victims)
+{
+    QMutexLocker spillLock(&spillMutex);
+    if (!spillFile.isOpen() && !spillFile.open())
+        return false;
+    QVector<QByteArray> data;
+    mutex.lock();
+    for (int i : victims)
+        data << entries.at(i).data; // Shared, not copied.
+    mutex.unlock();
+    QVector<qint64> offsets;
+    qint64 offset = spillFile.size();
+    if (!spillFile.seek(offset))
+        return false;
+    for (auto& d : data) {
+        if (spillFile.write(d) != d.size())
+            return false;
+        offsets << offset;
+        offset += d.size();
+    }
+    QMutexLocker lock(&mutex);
+    for (int j = 0; j < victims.size(); j++) {
+        auto& e = entries[victims.at(j)];
+        e.offset = offsets.at(j);
+        e.data = QByteArray();
+    }
+    return true;
+}
+
+bool CandidateStore::load(const Entry& e, cv::Mat& image)
+{
+    QByteArray data = e.data;
+    if (e.offset >= 0) {
+        if (!spillFile.seek(e.offset))
+            return false;
+        data = spillFile.read(e.storedBytes);
+        if (data.size() != e.storedBytes)
+            return false;
+    }
+    image.create(e.rows, e.cols, e.type);
+    int rawBytes = image.total() * image.elemSize();
+    if (e.compressed) {
+#ifdef HAVE_LZ4
+        auto out = reinterpret_cast<char*>(image.data);
+        return LZ4_decompress_safe(data.constData(), out, data.size(),
+                                   rawBytes) == rawBytes;
+#else
+        return false;
+#endif
+    }
+    if (data.size() != rawBytes)
+        return false;
+    memcpy(image.data, data.constData(), rawBytes);
+    return true;
+}
+
+bool CandidateStore::saveBest(int percent, SaveFunction save)
+{
+    QMutexLocker spillLock(&spillMutex);
+    QMutexLocker lock(&mutex);
+    QVector<KnownFrame> frames;
+    frames.reserve(entries.size());
+    for (int i = 0; i < entries.size(); i++)
+        frames << KnownFrame{i, entries.at(i).info.quality, QRect()};
+    bool success = true;
+    cv::Mat image;
+    for (auto& f : selectBestFrames(frames, percent)) {
+        auto& e = entries.at(f.index);
+        success = load(e, image) && save(image, e.info) && success;
+    }
+    return success;
+}
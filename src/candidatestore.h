@@ -0,0 +1,97 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CANDIDATESTORE_H
+#define CANDIDATESTORE_H
+
+#include "processing.h"
+#include <QMutex>
+#include <QVector>
+#include <QTemporaryFile>
+#include <QDateTime>
+#include <opencv2/core/core.hpp>
+#include <functional>
+#include <queue>
+#include <atomic>
+
+/*
+ * Keeps the images of all processed frames until the end of processing,
+ * when the best ones can be picked. This allows filtering the entire
+ * input by acceptance rate in one pass, also for inputs that can't be
+ * read again. Images are compressed (with LZ4 if available) and kept in
+ * memory up to a limit. When the limit is exceeded, the images with the
+ * lowest quality, which are the least likely to be saved, are moved to
+ * a temporary file.
+ *
+ * Since any frame can still end up among the best ones as long as more
+ * frames arrive, nothing is ever discarded: a few dozen bytes per frame
+ * are kept in memory, and the temporary file grows by the compressed
+ * size of every image beyond the memory limit.
+ */
+class CandidateStore
+{
+public:
+    struct Candidate {
+        QString filename;
+        QDateTime timestamp;
+        float quality;
+        OutputFormat format;
+    };
+    typedef std::function<bool(const cv::Mat& image, const Candidate& c)>
+        SaveFunction;
+
+    explicit CandidateStore(size_t memoryLimit);
+
+    // Stores a copy of the image. Thread safe, and only callers that
+    // have to move images to the temporary file wait for the disk.
+    bool add(const cv::Mat& image, const Candidate& c);
+
+    // Saves the given percentage of the best candidates, in the order in
+    // which they were added. Images being spilled are waited for.
+    bool saveBest(int percent, SaveFunction save);
+
+    // The memory limit of stores made from now on, 512 MiB by default.
+    static void setDefaultMemoryLimit(size_t bytes);
+    static size_t defaultMemoryLimit();
+
+private:
+    struct Entry {
+        Candidate info;
+        int rows, cols, type;
+        bool compressed;
+        QByteArray data; // Empty if spilled.
+        qint64 offset = -1; // Position in the spill file.
+        int storedBytes;
+    };
+    typedef std::pair<float, int> Ranked; // Quality and entry index.
+
+    bool spill(const QVector<int>& victims);
+    bool load(const Entry& e, cv::Mat& image);
+
+    // When both are needed, spillMutex is locked first.
+    QMutex mutex, spillMutex;
+    QVector<Entry> entries;
+    // Entries still in memory, the lowest quality first.
+    std::priority_queue<Ranked, std::vector<Ranked>, std::greater<Ranked>> inMemory;
+    size_t memoryUsed = 0, memoryLimit;
+    QTemporaryFile spillFile; // Guarded by spillMutex.
+
+    static std::atomic<size_t> defaultLimit;
+};
+
+#endif
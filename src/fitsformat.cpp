@@ -0,0 +1,322 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fitsformat.h"
+#include "bufferpool.h"
+#include <QFile>
+#include <QtEndian>
+#include <cstring>
+
+using namespace Fits;
+
+static const int cardSize = 80;
+static const int keywordSize = 8;
+
+// Returns the value of a "KEYWORD = value / comment" card, without quotes.
+static QByteArray cardValue(const QByteArray& card)
+{
+    QByteArray v = card.mid(keywordSize + 2).trimmed();
+    if (v.startsWith('\'')) {
+        QByteArray s;
+        for (int i = 1; i < v.size(); i++) {
+            if (v[i] == '\'') {
+                if (i + 1 < v.size() && v[i + 1] == '\'')
+                    i++;
+                else
+                    break;
+            }
+            s += v[i];
+        }
+        return s.trimmed();
+    }
+    int comment = v.indexOf('/');
+    if (comment >= 0)
+        v.truncate(comment);
+    // Fortran-style exponents.
+    return v.trimmed().replace('D', 'E');
+}
+
+QString Header::parse(const char* data, qint64 bytes)
+{
+    *this = Header();
+    bool simple = false, end = false;
+    for (qint64 pos = 0; pos + cardSize <= bytes; pos += cardSize) {
+        QByteArray card = QByteArray::fromRawData(data + pos, cardSize);
+        QByteArray key = card.left(keywordSize).trimmed();
+        if (pos == 0 && key != "SIMPLE")
+            return "File is not a FITS image.";
+        if (key == "END") {
+            end = true;
+            dataOffset = (pos / blockSize + 1) * blockSize;
+            break;
+        }
+        if (card.mid(keywordSize, 2) != "= ")
+            continue;
+        QByteArray value = cardValue(card);
+        bool ok = true;
+        if (key == "SIMPLE") {
+            simple = value == "T";
+        } else if (key == "BITPIX") {
+            bitpix = value.toInt(&ok);
+        } else if (key == "NAXIS") {
+            naxis = value.toInt(&ok);
+        } else if (key.startsWith("NAXIS")) {
+            int axis = key.mid(5).toInt();
+            if (axis >= 1 && axis <= 3)
+                axes[axis - 1] = value.toLongLong(&ok);
+        } else if (key == "BZERO") {
+            bzero = value.toDouble(&ok);
+        } else if (key == "BSCALE") {
+            bscale = value.toDouble(&ok);
+        } else if (key == "DATE-OBS") {
+            dateObs = QDateTime::fromString(value, Qt::ISODate);
+            dateObs.setTimeSpec(Qt::UTC);
+        } else if (key == "QUALITY") {
+            quality = value.toDouble(&ok);
+        }
+        if (!ok)
+            return "Invalid FITS header card " + key + ".";
+    }
+
+    if (!end)
+        return "FITS header is incomplete.";
+    if (!simple)
+        return "File does not conform to the FITS standard.";
+    if (naxis < 2 || naxis > 3 || width() <= 0 || height() <= 0 ||
+        (naxis == 3 && axes[2] <= 0))
+        return "Unsupported FITS image dimensions.";
+    if (bitpix != 8 && bitpix != 16 && bitpix != 32 &&
+        bitpix != -32 && bitpix != -64)
+        return "Unsupported FITS sample format.";
+    return QString{};
+}
+
+QByteArray Header::serialize() const
+{
+    QByteArray h;
+    // Numbers and logicals are right-aligned to column 30, strings are not.
+    auto card = [&h](const char* key, const QByteArray& value,
+                     const char* comment = nullptr) {
+        QByteArray c = QByteArray(key).leftJustified(keywordSize) + "= ";
+        c += value.startsWith('\'') ? value : value.rightJustified(20);
+        if (comment)
+            c += QByteArray(" / ") + comment;
+        h += c.leftJustified(cardSize, ' ', true);
+    };
+    card("SIMPLE", "T");
+    card("BITPIX", QByteArray::number(bitpix));
+    card("NAXIS", QByteArray::number(naxis));
+    for (int i = 0; i < naxis; i++)
+        card(QByteArray("NAXIS" + QByteArray::number(i + 1)).constData(),
+             QByteArray::number(axes[i]));
+    if (bzero != 0)
+        card("BZERO", QByteArray::number(bzero, 'g', 17));
+    if (bscale != 1)
+        card("BSCALE", QByteArray::number(bscale, 'g', 17));
+    if (dateObs.isValid())
+        card("DATE-OBS", "'" + dateObs.toUTC().toString("yyyy-MM-ddThh:mm:ss.zzz")
+             .toLatin1() + "'", "UTC");
+    if (quality >= 0)
+        card("QUALITY", QByteArray::number(quality, 'g', 8),
+             "Image quality estimated by arif");
+    h += QByteArray("END").leftJustified(cardSize);
+    int padding = (blockSize - h.size() % blockSize) % blockSize;
+    h += QByteArray(padding, ' ');
+    return h;
+}
+
+int Header::cvDepth() const
+{
+    bool identity = bzero == 0 && bscale == 1;
+    if (bitpix == 8 && identity)
+        return CV_8U;
+    if (bitpix == 16 && bscale == 1 && bzero == 32768)
+        return CV_16U;
+    if (bitpix == 16 && identity)
+        return CV_16S;
+    if (bitpix == 32 && identity)
+        return CV_32S;
+    return CV_32F;
+}
+
+static inline void load(const uchar* p, quint8& v) { v = *p; }
+static inline void load(const uchar* p, quint16& v) { v = qFromBigEndian<quint16>(p) ^ 0x8000; }
+static inline void load(const uchar* p, qint16& v) { v = qFromBigEndian<qint16>(p); }
+static inline void load(const uchar* p, qint32& v) { v = qFromBigEndian<qint32>(p); }
+
+static inline void store(quint8 v, uchar* p) { *p = v; }
+static inline void store(quint16 v, uchar* p) { qToBigEndian<quint16>(v ^ 0x8000, p); }
+static inline void store(qint16 v, uchar* p) { qToBigEndian(v, p); }
+static inline void store(qint32 v, uchar* p) { qToBigEndian(v, p); }
+static inline void store(float v, uchar* p)
+{
+    quint32 u;
+    memcpy(&u, &v, sizeof(u));
+    qToBigEndian(u, p);
+}
+
+static inline double sample(const uchar* p, int bitpix)
+{
+    switch (bitpix) {
+    case 8:
+        return *p;
+    case 16:
+        return qFromBigEndian<qint16>(p);
+    case 32:
+        return qFromBigEndian<qint32>(p);
+    case -32: {
+        quint32 u = qFromBigEndian<quint32>(p);
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+    default: {
+        quint64 u = qFromBigEndian<quint64>(p);
+        double d;
+        memcpy(&d, &u, sizeof(d));
+        return d;
+    }
+    }
+}
+
+template<typename T>
+static void loadPlane(const uchar* data, cv::Mat& out)
+{
+    qint64 rowBytes = qint64(out.cols) * sizeof(T);
+    for (int y = 0; y < out.rows; y++) {
+        auto src = data + (out.rows - 1 - y) * rowBytes;
+        auto dst = out.ptr<T>(y);
+        for (int x = 0; x < out.cols; x++, src += sizeof(T))
+            load(src, dst[x]);
+    }
+}
+
+void Fits::readPlane(const char* data, const Header& h, cv::Mat& out)
+{
+    int depth = h.cvDepth();
+    out.create(h.height(), h.width(), CV_MAKETYPE(depth, 1));
+    auto p = reinterpret_cast<const uchar*>(data);
+    switch (depth) {
+    case CV_8U:
+        loadPlane<quint8>(p, out);
+        break;
+    case CV_16U:
+        loadPlane<quint16>(p, out);
+        break;
+    case CV_16S:
+        loadPlane<qint16>(p, out);
+        break;
+    case CV_32S:
+        loadPlane<qint32>(p, out);
+        break;
+    default: {
+        int bytes = h.bytesPerSample();
+        qint64 rowBytes = qint64(out.cols) * bytes;
+        for (int y = 0; y < out.rows; y++) {
+            auto src = p + (out.rows - 1 - y) * rowBytes;
+            auto dst = out.ptr<float>(y);
+            for (int x = 0; x < out.cols; x++, src += bytes)
+                dst[x] = sample(src, h.bitpix) * h.bscale + h.bzero;
+        }
+    }
+    }
+}
+
+template<typename T>
+static void storePlane(const cv::Mat& image, int channel, uchar* out)
+{
+    int channels = image.channels();
+    qint64 rowBytes = qint64(image.cols) * sizeof(T);
+    for (int y = 0; y < image.rows; y++) {
+        auto src = image.ptr<T>(y) + channel;
+        auto dst = out + (image.rows - 1 - y) * rowBytes;
+        for (int x = 0; x < image.cols; x++, src += channels, dst += sizeof(T))
+            store(*src, dst);
+    }
+}
+
+bool Fits::writeImage(const cv::Mat& image, const QDateTime& timestamp,
+                      double quality, const QString& filename)
+{
+    cv::Mat converted;
+    Header h;
+    switch (image.depth()) {
+    case CV_8U:
+        h.bitpix = 8;
+        break;
+    case CV_16U:
+        h.bitpix = 16;
+        h.bzero = 32768;
+        break;
+    case CV_16S:
+        h.bitpix = 16;
+        break;
+    case CV_32S:
+        h.bitpix = 32;
+        break;
+    case CV_32F:
+        h.bitpix = -32;
+        break;
+    default:
+        image.convertTo(converted, CV_32F);
+        h.bitpix = -32;
+    }
+    const cv::Mat& src = converted.empty() ? image : converted;
+    int channels = src.channels();
+    h.naxis = channels > 1 ? 3 : 2;
+    h.axes[0] = src.cols;
+    h.axes[1] = src.rows;
+    h.axes[2] = channels;
+    h.dateObs = timestamp;
+    h.quality = quality;
+
+    QByteArray header = h.serialize();
+    qint64 planeBytes = h.planeBytes();
+    qint64 dataBytes = planeBytes * channels;
+    qint64 padded = (dataBytes + blockSize - 1) / blockSize * blockSize;
+    FrameBuffer buffer(header.size() + padded);
+    memcpy(buffer.data(), header.constData(), header.size());
+    auto data = reinterpret_cast<uchar*>(buffer.data()) + header.size();
+    memset(data + dataBytes, 0, padded - dataBytes);
+    // Color planes are stored in RGB order.
+    for (int c = 0; c < channels; c++) {
+        auto out = data + c * planeBytes;
+        int channel = channels - 1 - c;
+        switch (src.depth()) {
+        case CV_8U:
+            storePlane<quint8>(src, channel, out);
+            break;
+        case CV_16U:
+            storePlane<quint16>(src, channel, out);
+            break;
+        case CV_16S:
+            storePlane<qint16>(src, channel, out);
+            break;
+        case CV_32S:
+            storePlane<qint32>(src, channel, out);
+            break;
+        default:
+            storePlane<float>(src, channel, out);
+        }
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    return file.write(buffer.constData(), buffer.size()) == qint64(buffer.size());
+}
@@ -0,0 +1,71 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FITSFORMAT_H
+#define FITSFORMAT_H
+
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+#include <opencv2/core/core.hpp>
+
+/*
+ * The FITS image format. A file starts with a header of 80-character
+ * "KEYWORD = value" cards, padded to 2880-byte blocks, followed by the
+ * big-endian samples of the primary array, also padded. Images are stored
+ * with the bottom row first.
+ */
+namespace Fits
+{
+
+static const int blockSize = 2880;
+
+struct Header {
+    int bitpix = 16; // 8, 16, 32 for integers, -32, -64 for floats.
+    int naxis = 0;
+    qint64 axes[3] = {0, 0, 0};
+    double bzero = 0, bscale = 1;
+    QDateTime dateObs; // Invalid if absent.
+    double quality = -1; // Written by arif, negative if absent.
+    qint64 dataOffset = 0; // Size of the header including padding.
+
+    // Returns an empty string on success.
+    QString parse(const char* data, qint64 bytes);
+    QByteArray serialize() const;
+
+    int width() const { return axes[0]; }
+    int height() const { return axes[1]; }
+    qint64 planes() const { return naxis > 2 ? axes[2] : 1; }
+    int bytesPerSample() const { return qAbs(bitpix) / 8; }
+    qint64 planeBytes() const {
+        return qint64(width()) * height() * bytesPerSample();
+    }
+    // OpenCV depth of the decoded samples. Scaled integers become floats.
+    int cvDepth() const;
+};
+
+// Converts one plane of samples to an image of cvDepth(), flipping it.
+void readPlane(const char* data, const Header& h, cv::Mat& out);
+
+// Writes a gray or BGR image as one file, without compression.
+bool writeImage(const cv::Mat& image, const QDateTime& timestamp,
+                double quality, const QString& filename);
+
+}
+
+#endif
@@ -17,12 +17,32 @@
  */
 
 #include "foreman.h"
+#include "affinity.h"
+#include "candidatestore.h"
+#include "resultslog.h"
+#include "ringrecorder.h"
 #include <QtConcurrentRun>
+#include <QFile>
 #include <opencv2/highgui/highgui.hpp>
 
+// Selected frames closer than this are reached by reading, not seeking.
+static const qint64 maxSkippedFrames = 16;
+// Weight of a new frame in the moving average of the frame rate.
+static const double arrivalWeight = 0.1;
+
 Foreman::Foreman(QObject* parent):
     QObject(parent), flushWatcher(new FlushWatcher(this))
 {
+    ioPool.setMaxThreadCount(1);
+}
+
+Foreman::~Foreman()
+{
+    ioPool.waitForDone();
+    // Candidates whose flush never got to run are saved now.
+    if (candidates)
+        flush({}, settings->acceptancePercent, serSink, candidates);
+    closeSink();
 }
 
 bool Foreman::isStarted()
@@ -33,22 +53,99 @@ bool Foreman::isStarted()
 void Foreman::start()
 {
     started = true;
+    inputEnded = false;
+    saveFailed = false;
+    updateSink();
     requestAnotherFrame();
 }
 
 void Foreman::stop()
 {
     started = false;
-    if (runningJobs == 0) {
+    selection.clear();
+    // Stopping is complete once everything is saved, see flushComplete().
+    if (runningJobs == 0)
         flushFilteringQueue();
-        emit stopped();
-    }
 }
 
 void Foreman::updateSettings(const ProcessingSettings& settings_)
 {
     settings = QSharedPointer<ProcessingSettings>(new ProcessingSettings);
     *settings = settings_;
+    settings->serSink.clear();
+    settings->candidates.clear();
+    updateSink();
+}
+
+// Opens a SER video when saving to one starts. It stays open until the
+// foreman stops, even if saving is disabled in the meantime. The same
+// goes for the store of candidates when filtering with BestOfAll and
+// for the log of results, which is written whenever there is a
+// destination directory, also when images are not saved.
+void Foreman::updateSink()
+{
+    auto prefix = QString("%1/arif-%2")
+                  .arg(settings->saveImagesDirectory)
+                  .arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"));
+    if (started && !settings->saveImagesDirectory.isEmpty() && !resultsLog) {
+        // Passes over the entire file can follow each other within a second.
+        auto name = prefix + ".results";
+        for (int i = 2; QFile::exists(name); i++)
+            name = QString("%1-%2.results").arg(prefix).arg(i);
+        resultsLog = QSharedPointer<ResultsLog>(new ResultsLog(name));
+    }
+    if (started && settings->ringRecording && !recorder) {
+        auto s = settings.data();
+        double rate = arrivalInterval > 0 ? 1e9 / arrivalInterval : 0;
+        recorder = QSharedPointer<RingRecorder>(
+            new RingRecorder(s->saveImagesDirectory, s->ringSeconds,
+                             s->ringAfterSeconds, s->ringTrigger, s->ringWindow,
+                             rate));
+    }
+    bool collect = started && settings->saveImages &&
+                   settings->filterType == QualityFilterType::BestOfAll;
+    if (collect && !candidates) {
+        auto limit = CandidateStore::defaultMemoryLimit();
+        candidates = QSharedPointer<CandidateStore>(new CandidateStore(limit));
+    }
+    auto store = collect ? candidates : QSharedPointer<CandidateStore>();
+    bool wanted = started && settings->saveImages &&
+                  settings->outputFormat == OutputFormat::Ser;
+    if (wanted && !serSink)
+        serSink = QSharedPointer<SerSink>(new SerSink(prefix));
+    auto active = wanted ? serSink : QSharedPointer<SerSink>();
+    if (settings->serSink != active || settings->candidates != store) {
+        auto s = new ProcessingSettings;
+        *s = *settings;
+        s->serSink = active;
+        s->candidates = store;
+        settings = QSharedPointer<ProcessingSettings>(s);
+    }
+}
+
+bool Foreman::closeSink()
+{
+    bool success = true;
+    if (resultsLog && !resultsLog->close()) {
+        qDebug() << "Error writing the results log.";
+        success = false;
+    }
+    resultsLog.clear();
+    if (recorder && !recorder->close()) {
+        qDebug() << "Error writing recorded frames.";
+        success = false;
+    }
+    recorder.clear();
+    if (!serSink)
+        return success;
+    if (!serSink->close()) {
+        qDebug() << "Error writing SER video.";
+        success = false;
+    }
+    serSink.clear();
+    if (settings)
+        updateSink();
+    return success;
 }
 
 void Foreman::renderNextFrame()
@@ -57,6 +154,99 @@ void Foreman::renderNextFrame()
 }
 
 void Foreman::takeFrame(SharedRawFrame frame)
+{
+    takeFrames(QVector<SharedRawFrame>{frame});
+}
+
+void Foreman::takeFrames(QVector<SharedRawFrame> frames)
+{
+    emit framesReceived(frames.size(), started);
+    framesSinceRender += frames.size();
+    if (settings->display && framesSinceRender > settings->displayInterval) {
+        framesSinceRender = 0;
+        render = true;
+    }
+    bool dispatched = false, skipped = false;
+    for (auto& frame: frames) {
+        qint64 arrival = frame->metaData.arrival;
+        if (lastArrival > 0 && arrival > lastArrival)
+            arrivalInterval += arrivalWeight *
+                               (arrival - lastArrival - arrivalInterval);
+        lastArrival = arrival;
+    }
+    if (recorder && started) {
+        for (auto& frame: frames)
+            recorder->addFrame(frame);
+    }
+    for (auto& frame: frames) {
+        qint64 index = nextFrameIndex >= 0 ? nextFrameIndex++ : -1;
+        if (selection.isEmpty()) {
+            dispatched = dispatchFrame(frame, index) || dispatched;
+            continue;
+        }
+        while (selectionPosition < selection.size() &&
+               selection.at(selectionPosition).index < index)
+            selectionPosition++;
+        if (selectionPosition < selection.size() &&
+            selection.at(selectionPosition).index == index) {
+            auto& known = selection.at(selectionPosition);
+            if (dispatchFrame(frame, index, &known)) {
+                selectionPosition++;
+                dispatched = true;
+            } else if (settings->plugin->reader()->seek(index)) {
+                // No worker was free, so read the frame again once one
+                // is. Frames after it are read again as well.
+                nextFrameIndex = index;
+                break;
+            } else {
+                qDebug() << "Selected frame" << index << "was not processed.";
+                selectionPosition++;
+            }
+        } else {
+            skipped = true;
+        }
+    }
+    if (!selection.isEmpty() && selectionPosition >= selection.size() &&
+        !inputEnded) {
+        inputEnded = true;
+        emit selectionFinished();
+    }
+    if (dispatched || skipped)
+        requestAnotherFrame();
+}
+
+void Foreman::seek(qint64 frame)
+{
+    bool sought = settings->plugin->reader()->seek(frame);
+    nextFrameIndex = sought ? frame : -1;
+    inputEnded = false;
+    requestAnotherFrame();
+}
+
+void Foreman::requestFrame()
+{
+    settings->plugin->reader()->readFrame();
+}
+
+void Foreman::inputFinished()
+{
+    inputEnded = true;
+}
+
+void Foreman::processKnownFrames(QVector<KnownFrame> frames)
+{
+    selection = frames;
+    selectionPosition = 0;
+    if (selection.isEmpty()) {
+        inputEnded = true;
+        emit selectionFinished();
+        return;
+    }
+    seek(selection.first().index);
+}
+
+bool Foreman::dispatchFrame(SharedRawFrame frame, qint64 index,
+                            const KnownFrame* known)
 {
     // Discard frame if no free threads
     if ((started || render) && haveIdleThreads()) {
@@ -70,6 +260,14 @@ void Foreman::takeFrame(SharedRawFrame frame)
             data->reset(settings);
         }
         data->rawFrame = frame;
+        data->frameIndex = index;
+        data->arrived = frame->metaData.arrival;
+        data->admitted = monotonicTime();
+        if (known) {
+            data->known = true;
+            data->quality = known->quality;
+            data->cropArea = known->cropArea;
+        }
         data->doRender = render;
         data->onlyRender = render && !started;
         render = false;
@@ -82,9 +280,10 @@ void Foreman::takeFrame(SharedRawFrame frame)
         }
         watcher->setFuture(QtConcurrent::run(processData, data));
         runningJobs++;
-        requestAnotherFrame();
+        return true;
     } else {
-        emit frameMissed();
+        emit frameMissed(index);
+        return false;
     }
 }
 
@@ -98,6 +297,7 @@ void Foreman::processingComplete()
         qDebug() << msg.arg(d->exception.stageName, d->exception.errorMessage);
         if (previousStage == ProcessingStage::Save) {
             qDebug() << "Error writing image, saving disabled.";
+            saveFailed = true;
             auto s = new ProcessingSettings;
             *s = *settings;
             s->saveImages = false;
@@ -115,11 +315,17 @@ void Foreman::processingComplete()
             QueuedImage qi;
             qi.image = tmp;
             qi.filename = d->filename;
+            qi.timestamp = d->rawFrame->metaData.timestamp;
             qi.quality = d->quality;
+            qi.format = d->settings->outputFormat;
             filterQueue << qi;
         }
+        if (resultsLog && !d->onlyRender)
+            resultsLog->append(*d);
+        if (recorder && d->completedStages.contains(ProcessingStage::EstimateQuality))
+            recorder->addQuality(d->quality);
     }
-    emit frameProcessed(d);
+    emit frameProcessed(snapshot(d));
     futureWatcherPool << watcher;
     dataPool << d;
     runningJobs--;
@@ -128,25 +334,74 @@ void Foreman::processingComplete()
         flushFilteringQueue();
     if (!started && runningJobs == 0) {
         flushFilteringQueue();
-        emit stopped();
     } else {
         requestAnotherFrame();
     }
 }
 
+// The processing data is reused as soon as it is returned to the pool,
+// so listeners in other threads get their own copy.
+SharedData Foreman::snapshot(SharedData d)
+{
+    auto s = SharedData(new ProcessingData);
+    s->stageSuccessful = d->stageSuccessful;
+    s->exception = d->exception;
+    s->completedStages = d->completedStages;
+    s->settings = d->settings;
+    s->frameIndex = d->frameIndex;
+    s->known = d->known;
+    s->cropArea = d->cropArea;
+    s->cvCropArea = d->cvCropArea;
+    s->centroid = d->centroid;
+    std::copy_n(d->stageTimes, processingStageCount, s->stageTimes);
+    s->arrived = d->arrived;
+    s->admitted = d->admitted;
+    s->workStarted = d->workStarted;
+    s->workFinished = d->workFinished;
+    s->quality = d->quality;
+    s->accepted = d->accepted;
+    s->filename = d->filename;
+    s->doRender = d->doRender;
+    s->onlyRender = d->onlyRender;
+    if (d->doRender) {
+        s->renderedFrame.swap(d->renderedFrame);
+        s->histograms.swap(d->histograms);
+        s->paintObjects = d->paintObjects;
+        s->decoded = d->decoded.clone();
+    }
+    return s;
+}
+
 // Save images to disk and return them to be put back into foreman's imagePool.
 Foreman::FlushReturn
-Foreman::flush(QList< Foreman::QueuedImage > queue, int acceptance)
+Foreman::flush(QList< Foreman::QueuedImage > queue, int acceptance,
+               QSharedPointer<SerSink> sink,
+               QSharedPointer<CandidateStore> candidates)
 {
+    pinCurrentThread(ThreadRole::IO);
     QList<QSharedPointer<cv::Mat>> localPool;
     bool success = true;
     std::sort(queue.begin(), queue.end());
     int min = queue.count() * (100 - acceptance) / 100;
     for (int i = queue.count() - 1; i >= min; i--) {
         auto& qi = queue.at(i);
-        success = success && saveImage(*qi.image, qi.filename);
+        if (sink)
+            success = success && sink->write(*qi.image, qi.timestamp, qi.quality);
+        else
+            success = success && saveImage(*qi.image, qi.filename, qi.format,
+                                             qi.timestamp, qi.quality);
         localPool << qi.image;
     }
+    if (candidates) {
+        auto save = [&sink](const cv::Mat& image,
+                            const CandidateStore::Candidate& c) {
+            if (sink)
+                return sink->write(image, c.timestamp, c.quality);
+            return saveImage(image, c.filename, c.format, c.timestamp,
+                             c.quality);
+        };
+        success = candidates->saveBest(acceptance, save) && success;
+    }
     return qMakePair(success, localPool);
 }
 
@@ -154,7 +409,15 @@ void Foreman::flushFilteringQueue()
 {
     if (queueFlushFuture.isRunning())
         return;
-    queueFlushFuture = QtConcurrent::run(flush, filterQueue, settings->acceptancePercent);
+    // The best candidates are known only when all frames were processed.
+    QSharedPointer<CandidateStore> finished;
+    if (!started && runningJobs == 0) {
+        finished.swap(candidates);
+        updateSink();
+    }
+    queueFlushFuture = QtConcurrent::run(&ioPool, flush, filterQueue,
+                                         settings->acceptancePercent,
+                                         settings->serSink, finished);
     filterQueue.clear();
     connect(flushWatcher, SIGNAL(finished()), SLOT(flushComplete()));
     flushWatcher->setFuture(queueFlushFuture);
@@ -167,6 +430,7 @@ void Foreman::flushComplete()
     imagePool.append(val.second);
     if (!val.first) {
         qDebug() << "Error writing images, saving disabled.";
+        saveFailed = true;
         auto s = new ProcessingSettings;
         *s = *settings;
         s->saveImages = false;
@@ -174,9 +438,18 @@ void Foreman::flushComplete()
     }
     // Drop references etc.
     queueFlushFuture = QFuture<FlushReturn>();
+    // The SER video is finished once everything queued for it is written.
+    if (!started && runningJobs == 0) {
+        if (!filterQueue.isEmpty() || candidates) {
+            flushFilteringQueue();
+        } else {
+            saveFailed = !closeSink() || saveFailed;
+            emit stopped(!saveFailed);
+        }
+    }
 }
 
-bool Foreman::haveIdleThreads()
+int Foreman::idleThreads()
 {
     /*
      * The runningJobs counter and the actual number of active threads are
@@ -187,13 +460,25 @@ bool Foreman::haveIdleThreads()
      * there is not too much overcommit of resources.
      */
     auto p = QThreadPool::globalInstance();
-    return p->activeThreadCount() < p->maxThreadCount() &&
-           (int)runningJobs < 2 * p->maxThreadCount();
+    return qMin(p->maxThreadCount() - p->activeThreadCount(),
+                2 * p->maxThreadCount() - (int)runningJobs);
+}
+
+bool Foreman::haveIdleThreads()
+{
+    return idleThreads() > 0;
 }
 
 void Foreman::requestAnotherFrame()
 {
-    if (started && haveIdleThreads()) {
-        emit ready();
+    int count = idleThreads();
+    if (started && !inputEnded && count > 0) {
+        if (selectionPosition < selection.size()) {
+            qint64 wanted = selection.at(selectionPosition).index;
+            if (wanted - nextFrameIndex > maxSkippedFrames &&
+                settings->plugin->reader()->seek(wanted))
+                nextFrameIndex = wanted;
+        }
+        emit readyForFrames(count);
     }
 }
@@ -20,9 +20,15 @@
 #define FOREMAN_H
 
 #include "processing.h"
+#include "sersink.h"
 #include <QThreadPool>
 #include <QFutureWatcher>
 #include <QList>
+#include <atomic>
+
+class CandidateStore;
+class ResultsLog;
+class RingRecorder;
 
 class Foreman: public QObject
 {
@@ -32,7 +38,9 @@ class Foreman: public QObject
     struct QueuedImage {
         QSharedPointer<cv::Mat> image;
         QString filename;
+        QDateTime timestamp;
         float quality;
+        OutputFormat format;
         bool operator<(const QueuedImage& other) const {
             return quality < other.quality;
         }
@@ -48,8 +56,13 @@ class Foreman: public QObject
     typedef QFutureWatcher<SharedData> ProcessWatcher;
 
 public:
-    // Call updateSettings before use!
+    // Call updateSettings before use! The foreman is meant to live in its
+    // own thread together with the reader, so that frames reach the
+    // workers without passing through the GUI thread. Other threads
+    // should only call isStarted() directly and use queued invocations
+    // for the slots.
     explicit Foreman(QObject* parent = 0);
+    ~Foreman();
     bool isStarted();
 
 public slots:
@@ -70,6 +83,25 @@ public slots:
     // Invoked when a new frame is ready.
     void takeFrame(SharedRawFrame frame);
 
+    // Invoked when a batch of frames is ready.
+    void takeFrames(QVector<SharedRawFrame> frames);
+
+    // Seeks the reader and resumes reading if it was at the end.
+    void seek(qint64 frame);
+
+    // Asks the reader for a single frame, e.g. to show a preview.
+    void requestFrame();
+
+    // Invoked when the reader reaches the end. No more frames are
+    // requested until seek() is called.
+    void inputFinished();
+
+    // Processes only the given frames of a seekable video, which must be
+    // sorted by index, and seeks to the first one. Frames in between are
+    // skipped, or sought over if there are many. Their crop and quality
+    // are not computed again. The selection is dropped when stopped.
+    void processKnownFrames(QVector<KnownFrame> frames);
+
 private slots:
     // Invoked when a processing stage has completed.
     void processingComplete();
@@ -82,37 +114,68 @@ private slots:
     void flushComplete();
 
 signals:
-    // Emitted when a frame can be taken. Used by non-live sources
-    // to throttle data input and avoid framedrop.
-    void ready();
-
-    // Emitted when stopping is complete.
-    void stopped();
-
-    // Emmited when processing of a frame has completed. It makes all data
-    // available, but note that it will be reused immediately, so the
-    // receiving slot should either process it in the main thread or
-    // copy whatever it needs.
+    // Emitted when frames can be taken, giving how many. Used by
+    // non-live sources to throttle data input and avoid framedrop.
+    void readyForFrames(int count);
+
+    // Emitted when stopping is complete, after everything that was
+    // processed has been saved. 'saved' is false if saving failed at any
+    // time since the foreman was started.
+    void stopped(bool saved);
+
+    // Emmited when processing of a frame has completed. The data is a
+    // copy containing the results and statistics; the rendered image,
+    // histograms and decoded image are only included for rendered frames.
     void frameProcessed(SharedData data);
 
+    // Emitted for every batch of frames received from the reader.
+    // 'processing' tells whether the foreman was started at the time.
+    void framesReceived(int count, bool processing);
+
     // Emmited when there was no free threads to process a received frame.
-    void frameMissed();
+    // The index is that of the frame in a seekable video, or -1.
+    void frameMissed(qint64 index);
+
+    // Emitted when all frames given to processKnownFrames() were read.
+    void selectionFinished();
 
 private:
+    bool dispatchFrame(SharedRawFrame frame, qint64 index,
+                       const KnownFrame* known = nullptr);
+    int idleThreads();
     bool haveIdleThreads();
     void requestAnotherFrame();
-    static FlushReturn flush(QList<QueuedImage> queue, int acceptance);
+    static FlushReturn flush(QList<QueuedImage> queue, int acceptance,
+                             QSharedPointer<SerSink> sink,
+                             QSharedPointer<CandidateStore> candidates);
+    void updateSink();
+    bool closeSink();
+    static SharedData snapshot(SharedData data);
 
 private:
-    bool started = false;
+    std::atomic<bool> started{false};
     bool render = false;
+    bool inputEnded = false;
+    bool saveFailed = false;
+    int framesSinceRender = 0;
+    // Moving average of nanoseconds between frames of the source.
+    qint64 lastArrival = 0;
+    double arrivalInterval = 0;
+    qint64 nextFrameIndex = -1; // Index of the next frame read, if known.
+    QVector<KnownFrame> selection;
+    int selectionPosition = 0;
     QSharedPointer<ProcessingSettings> settings;
     QList<SharedData> dataPool;
     QList<ProcessWatcher*> futureWatcherPool;
     QList<QueuedImage> filterQueue;
     QList<SharedCvMat> imagePool; // For filterQueue.
     QFuture<FlushReturn> queueFlushFuture; // Flushing the queue is done in a thread.
+    QThreadPool ioPool; // Keeps saving off the processing threads.
     FlushWatcher* flushWatcher;
+    QSharedPointer<SerSink> serSink; // While saving to a SER video.
+    QSharedPointer<CandidateStore> candidates; // While filtering with BestOfAll.
+    QSharedPointer<ResultsLog> resultsLog; // While saving images.
+    QSharedPointer<RingRecorder> recorder; // While recording good seeing.
     uint runningJobs = 0; // Count resources taken out of their pools.
 };
 
@@ -0,0 +1,117 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "latencystats.h"
+#include "processing.h"
+#include <algorithm>
+
+// Percentiles are taken over this many of the most recent frames.
+static const int recentFrames = 100000;
+static const int worstFrames = 10;
+
+static QString milliseconds(qint64 ns)
+{
+    return QString::number(ns / 1e6, 'f', 2);
+}
+
+LatencyStats::LatencyStats()
+{
+    recent.reserve(recentFrames);
+}
+
+void LatencyStats::add(const ProcessingData& d)
+{
+    if (d.onlyRender || d.arrived <= 0 || d.workFinished <= 0)
+        return;
+    if (firstArrival < 0)
+        firstArrival = d.arrived;
+    Sample s;
+    s.total = d.workFinished - d.arrived;
+    s.toAdmission = d.admitted - d.arrived;
+    s.toWorker = d.workStarted - d.admitted;
+    s.processing = d.workFinished - d.workStarted;
+    s.arrived = d.arrived - firstArrival;
+    s.frameIndex = d.frameIndex;
+
+    if (recent.size() < recentFrames)
+        recent << s.total;
+    else
+        recent[recentPosition] = s.total;
+    recentPosition = (recentPosition + 1) % recentFrames;
+    samples++;
+
+    if (worstSamples.size() < worstFrames ||
+        s.total > worstSamples.last().total) {
+        auto at = std::upper_bound(worstSamples.begin(), worstSamples.end(), s,
+                                   [](const Sample& a, const Sample& b) {
+                                       return a.total > b.total;
+                                   });
+        worstSamples.insert(at, s);
+        if (worstSamples.size() > worstFrames)
+            worstSamples.removeLast();
+    }
+}
+
+void LatencyStats::clear()
+{
+    recent.clear();
+    recentPosition = 0;
+    samples = 0;
+    firstArrival = -1;
+    worstSamples.clear();
+}
+
+qint64 LatencyStats::percentile(double percent) const
+{
+    if (recent.isEmpty())
+        return 0;
+    auto sorted = recent;
+    int rank = qBound(0, int(percent / 100 * (sorted.size() - 1) + 0.5),
+                      sorted.size() - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted.at(rank);
+}
+
+QString LatencyStats::summary() const
+{
+    if (recent.isEmpty())
+        return QString("-");
+    qint64 max = worstSamples.isEmpty() ? 0 : worstSamples.first().total;
+    return QString("%1 / %2 / %3 ms")
+           .arg(milliseconds(percentile(50)))
+           .arg(milliseconds(percentile(99)))
+           .arg(milliseconds(max));
+}
+
+QString LatencyStats::report() const
+{
+    QString text = QString("Latency of %1 frames, median / 99% / maximum: %2")
+                   .arg(samples).arg(summary());
+    for (auto& s : worstSamples) {
+        text += QString("\n  %1 ms at %2 s").arg(milliseconds(s.total))
+                .arg(s.arrived / 1e9, 0, 'f', 3);
+        if (s.frameIndex >= 0)
+            text += QString(", frame %1").arg(s.frameIndex);
+        text += QString(": %1 ms to the foreman, %2 ms to a worker, "
+                        "%3 ms processing")
+                .arg(milliseconds(s.toAdmission))
+                .arg(milliseconds(s.toWorker))
+                .arg(milliseconds(s.processing));
+    }
+    return text;
+}
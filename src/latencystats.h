@@ -0,0 +1,72 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#include <QVector>
+#include <QString>
+
+struct ProcessingData;
+
+/*
+ * Collects how long frames take from arriving from the reader until a
+ * worker has finished them, i.e. until their quality is known. This is
+ * what a live source has to stay within, and it shows whether frames
+ * wait for the foreman, for a free worker or for the processing itself.
+ * Percentiles are taken over the most recent frames, the worst frames
+ * over all frames since the statistics were cleared.
+ */
+class LatencyStats
+{
+public:
+    struct Sample {
+        qint64 total;        // From arrival to the end of processing.
+        qint64 toAdmission;  // Waiting for the foreman.
+        qint64 toWorker;     // Waiting for a worker.
+        qint64 processing;
+        qint64 arrived;      // Since the first frame, all in nanoseconds.
+        qint64 frameIndex;   // Position in a seekable video, or -1.
+    };
+
+    LatencyStats();
+
+    // Frames that were only rendered or have no arrival time are ignored.
+    void add(const ProcessingData& d);
+    void clear();
+    int count() const { return samples; }
+
+    // End-to-end latency of recent frames at the given percentile.
+    qint64 percentile(double percent) const;
+    // Frames with the highest latency, the worst first.
+    const QVector<Sample>& worst() const { return worstSamples; }
+
+    // Median, 99th percentile and maximum, in milliseconds.
+    QString summary() const;
+    // The summary followed by a line for each of the worst frames.
+    QString report() const;
+
+private:
+    QVector<qint64> recent; // Circular.
+    int recentPosition = 0;
+    int samples = 0;
+    qint64 firstArrival = -1;
+    QVector<Sample> worstSamples; // Sorted, the worst first.
+};
+
+#endif
@@ -20,23 +20,39 @@
 #include <QApplication>
 #include "sourceselectionwindow.h"
 #include "arifmainwindow.h"
+#include "batchprocessor.h"
+#include "batchscheduler.h"
 #include "videosources/interfaces.h"
+#include "affinity.h"
+#include "bufferpool.h"
+#include "candidatestore.h"
 #include <tclap/CmdLine.h>
 #include <QSettings>
+#include <QTimer>
 #include <QPluginLoader>
+#include <QThreadPool>
+#include <QRegExp>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
 #include <iostream>
 #include <string>
 
 int main(int argc, char* argv[])
 {
-    QApplication a(argc, argv);
     QCoreApplication::setOrganizationDomain("ad-vega.si");
     QCoreApplication::setOrganizationName("AD Vega");
     QCoreApplication::setApplicationName("arif");
     VideoSourcePlugin* plugin = nullptr;
     QWidget* control;
     QString settingsFile, videoFile, destinationDir;
+    QStringList videoFiles, childArguments;
     bool showGUI;
+    int jobs, threads;
+    AffinitySettings affinity;
+    bool hugePages;
+    int poolLimit, candidateLimit;
 
     try {
         const char description[] =
@@ -45,51 +61,199 @@ int main(int argc, char* argv[])
             "was used are loaded."
             "\n"
             "The --input and --output options must be used together. "
-            "If they are absent, the GUI is started. Otherwise, --input "
+            "If they are absent, the GUI is started. Otherwise, processing "
+            "runs without a GUI and needs no display, unless --gui is given. "
+            "The --input option "
             "specifies the input video path and --output specifies the output "
             "directory where processed images are placed. The input path can "
             "be anything that is compatible with the input plugin specified "
-            "by the loaded settings, but must be a seekable source, e.g. "
-            "a video file, image directory or similar. The input will be "
-            "processed as if the 'Process entire file' option in the GUI "
-            "was selected.";
+            "by the loaded settings. The input will be processed as if the "
+            "'Process entire file' option in the GUI was selected. SER "
+            "videos and FITS cubes are read with the SER and FITS input "
+            "plugins regardless of the settings. The Synthetic input plugin "
+            "makes up frames of a planet and ignores the input path, which "
+            "allows measuring performance without a camera."
+            "\n"
+            "Inputs that can't be sought, e.g. pipes, are read only once "
+            "and all processed images are kept until the end, in memory up "
+            "to memory/candidatelimit megabytes (default 512) and in a "
+            "temporary file beyond that. The qualities found in the first "
+            "pass over other inputs are kept next to them, in a file with "
+            "the .arif-quality suffix, so that runs with different "
+            "acceptance rates skip that pass."
+            "\n"
+            "Several inputs can be given with repeated --input options or "
+            "with a --manifest file listing one input per line. Each of them "
+            "is then processed by a separate instance of the program, --jobs "
+            "of them at a time, and saved into its own subdirectory of the "
+            "output directory, named after the input. The --threads option "
+            "sets the number of processing threads of each instance."
+            "\n"
+            "The --worker-cpus, --io-cpus and --reader-cpus options pin "
+            "processing threads, image saving threads and background video "
+            "reading threads to the given CPUs, e.g. \"0-7,16-23\". They "
+            "override the affinity/workers, affinity/io and affinity/reader "
+            "keys of the settings file. The number of processing threads is "
+            "set to the number of worker CPUs."
+            "\n"
+            "The --huge-pages option backs large frame buffers with 2 MiB "
+            "pages, same as the memory/hugepages key of the settings file. "
+            "The memory/poollimit key sets how many megabytes of released "
+            "buffers are kept for reuse (default 1024).";
         TCLAP::CmdLine cmd(description);
 
         TCLAP::ValueArg<std::string>
         settingsArg("s", "settings", "Settings file to load",
                     false, std::string{}, "file", cmd);
+        TCLAP::MultiArg<std::string>
+        inputArg("i", "input", "Input video path, can be repeated",
+                 false, "video", cmd);
         TCLAP::ValueArg<std::string>
-        inputArg("i", "input", "Input video path",
-                 false, std::string{}, "video", cmd);
+        manifestArg("", "manifest", "File listing input video paths",
+                    false, std::string{}, "file", cmd);
+        TCLAP::ValueArg<int>
+        jobsArg("j", "jobs", "Number of inputs processed at the same time",
+                false, 2, "number", cmd);
+        TCLAP::ValueArg<int>
+        threadsArg("", "threads", "Number of processing threads",
+                   false, 0, "number", cmd);
         TCLAP::ValueArg<std::string>
         outputArg("o", "output", "Output directory for processed images",
                   false, std::string{}, "directory", cmd);
         TCLAP::SwitchArg
         guiArg("g", "gui", "Show GUI even when batch processing", cmd);
+        TCLAP::ValueArg<std::string>
+        workerCpusArg("", "worker-cpus", "CPUs for processing threads",
+                      false, std::string{}, "cpu list", cmd);
+        TCLAP::ValueArg<std::string>
+        ioCpusArg("", "io-cpus", "CPUs for image saving threads",
+                  false, std::string{}, "cpu list", cmd);
+        TCLAP::ValueArg<std::string>
+        readerCpusArg("", "reader-cpus", "CPUs for video reading threads",
+                      false, std::string{}, "cpu list", cmd);
+        TCLAP::SwitchArg
+        hugePagesArg("", "huge-pages", "Use huge pages for frame buffers", cmd);
 
         cmd.parse(argc, argv);
         settingsFile = QString::fromStdString(settingsArg.getValue());
-        videoFile = QString::fromStdString(inputArg.getValue());
+        for (auto& input : inputArg.getValue())
+            videoFiles << QString::fromStdString(input);
+        if (manifestArg.isSet()) {
+            QFile manifest(QString::fromStdString(manifestArg.getValue()));
+            if (!manifest.open(QIODevice::ReadOnly)) {
+                std::cerr << "Error: cannot read the manifest!" << std::endl;
+                return 1;
+            }
+            // Relative paths are relative to the manifest.
+            QDir dir(QFileInfo(manifest).absoluteDir());
+            QTextStream lines(&manifest);
+            while (!lines.atEnd()) {
+                auto line = lines.readLine().trimmed();
+                if (!line.isEmpty() && !line.startsWith('#'))
+                    videoFiles << dir.absoluteFilePath(line);
+            }
+        }
+        if (videoFiles.size() == 1)
+            videoFile = videoFiles.first();
+        jobs = jobsArg.getValue();
+        threads = threadsArg.getValue();
         destinationDir = QString::fromStdString(outputArg.getValue());
         showGUI = guiArg.getValue();
+
+        QScopedPointer<QSettings> config;
+        if (settingsFile.isEmpty())
+            config.reset(new QSettings);
+        else
+            config.reset(new QSettings(settingsFile, QSettings::IniFormat));
+        affinity.workerCpus = config->value("affinity/workers").toString();
+        affinity.ioCpus = config->value("affinity/io").toString();
+        affinity.readerCpus = config->value("affinity/reader").toString();
+        if (workerCpusArg.isSet())
+            affinity.workerCpus = QString::fromStdString(workerCpusArg.getValue());
+        if (ioCpusArg.isSet())
+            affinity.ioCpus = QString::fromStdString(ioCpusArg.getValue());
+        if (readerCpusArg.isSet())
+            affinity.readerCpus = QString::fromStdString(readerCpusArg.getValue());
+        hugePages = config->value("memory/hugepages", false).toBool() ||
+                    hugePagesArg.getValue();
+        poolLimit = config->value("memory/poollimit", 1024).toInt();
+        candidateLimit = config->value("memory/candidatelimit", 512).toInt();
+
+        // Options that instances processing a single input inherit.
+        if (settingsArg.isSet())
+            childArguments << "--settings" << settingsFile;
+        for (auto arg : {&workerCpusArg, &ioCpusArg, &readerCpusArg})
+            if (arg->isSet())
+                childArguments << QString::fromStdString("--" + arg->getName())
+                               << QString::fromStdString(arg->getValue());
+        if (hugePagesArg.isSet())
+            childArguments << "--huge-pages";
+        if (threadsArg.isSet())
+            childArguments << "--threads" << QString::number(threads);
     } catch (TCLAP::ArgException &e) {
         std::cerr << "Error processing argument " << e.argId() << std::endl
                   << e.error() << std::endl;
         return 1;
     }
 
-    if (!videoFile.isEmpty() && !destinationDir.isEmpty()) {
+    bool batch = !videoFiles.isEmpty() && !destinationDir.isEmpty();
+    if (!batch && (!videoFiles.isEmpty() || !destinationDir.isEmpty())) {
+        std::cerr << "Error: both input and output must be specified!" << std::endl;
+        return 1;
+    }
+    if (videoFiles.size() > 1 && showGUI) {
+        std::cerr << "Error: the GUI can only be shown for a single input!" << std::endl;
+        return 1;
+    }
+    // Widgets are only needed when the GUI is shown.
+    QScopedPointer<QCoreApplication> app;
+    if (batch && !showGUI)
+        app.reset(new QCoreApplication(argc, argv));
+    else
+        app.reset(new QApplication(argc, argv));
+
+    if (videoFiles.size() > 1) {
+        BatchScheduler scheduler(videoFiles, destinationDir, jobs, childArguments);
+        QObject::connect(&scheduler, &BatchScheduler::finished,
+                         [](int status) { QCoreApplication::exit(status); });
+        QTimer::singleShot(0, &scheduler, SLOT(start()));
+        return app->exec();
+    }
+
+    auto affinityError = configureAffinity(affinity);
+    if (!affinityError.isEmpty()) {
+        std::cerr << "Error: " << affinityError.toStdString() << std::endl;
+        return 1;
+    }
+    auto workerCpus = parseCpuList(affinity.workerCpus);
+    if (!workerCpus.isEmpty())
+        QThreadPool::globalInstance()->setMaxThreadCount(workerCpus.size());
+    if (threads > 0)
+        QThreadPool::globalInstance()->setMaxThreadCount(threads);
+
+    // All frame-sized buffers, including cv::Mat data, come from the pool.
+    BufferPool::instance()->setHugePages(hugePages);
+    BufferPool::instance()->setLimit(size_t(poolLimit) * 1024 * 1024);
+    cv::Mat::setDefaultAllocator(PooledMatAllocator::instance());
+    CandidateStore::setDefaultMemoryLimit(size_t(candidateLimit) * 1024 * 1024);
+
+    if (batch) {
         // Handle file processing.
         QScopedPointer<QSettings> config;
         if (settingsFile.isEmpty())
             config.reset(new QSettings);
         else
             config.reset(new QSettings(settingsFile, QSettings::IniFormat));
-        auto previousPluginName = config->value("settings/source").toString();
+        auto pluginName = config->value("settings/source").toString();
         config.reset();
+        // SER videos describe themselves and need no configuration.
+        if (videoFile.endsWith(".ser", Qt::CaseInsensitive))
+            pluginName = "SER";
+        else if (QRegExp(".*\\.(fits|fit|fts)", Qt::CaseInsensitive).exactMatch(videoFile))
+            pluginName = "FITS";
         for (auto pluginPtr : QPluginLoader::staticInstances()) {
             auto p = qobject_cast<VideoSourcePlugin*>(pluginPtr);
-            if (p != nullptr && p->name() == previousPluginName) {
+            if (p != nullptr && p->name() == pluginName) {
                 plugin = p;
                 break;
             }
@@ -104,33 +268,34 @@ int main(int argc, char* argv[])
             std::cerr << (QString("Error: input initialization failed: ") + init).toStdString() << std::endl;
             return 1;
         }
-        if (plugin->reader()->isSequential()) {
-            std::cerr << "Error: only seekable videos are supported in batch mode!" << std::endl;
-            return 1;
-        }
-        ArifMainWindow w(plugin, nullptr, settingsFile, destinationDir);
-        if (showGUI)
+        int status;
+        if (showGUI) {
+            ArifMainWindow w(plugin, nullptr, settingsFile, destinationDir);
             w.show();
-        a.processEvents();
-        w.acceptanceEntireFileCheck->setChecked(true);
-        a.processEvents();
-        w.processButton->setChecked(true);
-        return a.exec();
-    } else if (videoFile.isEmpty() && destinationDir.isEmpty()) {
-        // OK, show GUI and operate normally.
-        SourceSelectionWindow s;
-        s.exec();
-        plugin = s.result() == QDialog::Accepted ? s.selectedSource : nullptr;
-        control = s.sourceControl;
-    } else {
-        std::cerr << "Error: both input and output must be specified!" << std::endl;
-        return 1;
+            app->processEvents();
+            w.acceptanceEntireFileCheck->setChecked(true);
+            app->processEvents();
+            w.processButton->setChecked(true);
+            status = app->exec();
+        } else {
+            BatchProcessor b(plugin, settingsFile, destinationDir);
+            QObject::connect(&b, &BatchProcessor::finished,
+                             [](int status) { QCoreApplication::exit(status); });
+            QTimer::singleShot(0, &b, SLOT(start()));
+            status = app->exec();
+        }
+        return status;
     }
 
+    // Show GUI and operate normally.
+    SourceSelectionWindow s;
+    s.exec();
+    plugin = s.result() == QDialog::Accepted ? s.selectedSource : nullptr;
+    control = s.sourceControl;
     if (plugin) {
         ArifMainWindow w(plugin, control);
         w.show();
-        return a.exec();
+        return app->exec();
     }
     return 1;
 }
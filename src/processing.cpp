@@ -17,18 +17,28 @@
  */
 
 #include "processing.h"
+#include "sersink.h"
+#include "candidatestore.h"
+#include "fitsformat.h"
+#include "affinity.h"
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <QFont>
 #include <QFontMetrics>
 #include <QFile>
+#include <QElapsedTimer>
 #include <vector>
+#include <algorithm>
 #include <cstdint>
 
 static int registerTypes()
 {
     qRegisterMetaType<EstimatorSettings>("EstimatorSettings");
     qRegisterMetaTypeStreamOperators<EstimatorSettings>("EstimatorSettings");
+    // The foreman runs in its own thread.
+    qRegisterMetaType<ProcessingSettings>("ProcessingSettings");
+    qRegisterMetaType<SharedData>("SharedData");
+    qRegisterMetaType<QVector<KnownFrame>>("QVector<KnownFrame>");
     return 0;
 }
 
@@ -46,29 +56,70 @@ QDataStream& operator>>(QDataStream& in, EstimatorSettings& myObj)
     return in;
 }
 
+/*
+ * Full-frame intermediates that are only needed while a stage is running.
+ * Each processing thread has its own arena, so their number follows the
+ * number of threads rather than the number of ProcessingData in flight.
+ */
+struct ScratchArena {
+    // Owned buffers, reused from frame to frame.
+    cv::Mat floatBuffer, grayBuffer;
+    // These point either into the buffers above or into the decoded
+    // frame, and are cleared once the frame is done.
+    cv::Mat decodedFloat; // CV_32FC
+    cv::Mat grayscale;    // CV_32FC
+    // EstimateQuality
+    cv::Mat blurNoise, blurSignal;
+    // RenderFrame
+    cv::Mat renderTemporary;
+};
+
+static ScratchArena& scratch()
+{
+    static thread_local ScratchArena arena;
+    return arena;
+}
+
 void DecodeStage(SharedData d);
 void CropStage(SharedData d);
 void EstimateQualityStage(SharedData d);
 void RenderStage(SharedData d);
 void SaveStage(SharedData d);
 
+static void timedStage(void (*stage)(SharedData), ProcessingStage which,
+                       SharedData d)
+{
+    QElapsedTimer timer;
+    timer.start();
+    stage(d);
+    d->stageTimes[int(which)] = timer.nsecsElapsed();
+}
+
 SharedData processData(SharedData data)
 {
+    pinCurrentThread(ThreadRole::Worker);
+    data->workStarted = monotonicTime();
     data->stageSuccessful = true;
     data->exception = ProcessingException({"processData", "no error"});
     try {
-        DecodeStage(data);
-        RenderStage(data);
-        if (data->onlyRender)
-            return data;
-        CropStage(data);
-        EstimateQualityStage(data);
-        SaveStage(data);
+        timedStage(DecodeStage, ProcessingStage::Decode, data);
+        timedStage(RenderStage, ProcessingStage::Render, data);
+        if (!data->onlyRender) {
+            timedStage(CropStage, ProcessingStage::Crop, data);
+            timedStage(EstimateQualityStage, ProcessingStage::EstimateQuality,
+                       data);
+            timedStage(SaveStage, ProcessingStage::Save, data);
+        }
     }
     catch (ProcessingException& e) {
         data->stageSuccessful = false;
         data->exception = e;
     }
+    // Don't let the arena hold on to frame data of another decoder.
+    auto& a = scratch();
+    a.decodedFloat = cv::Mat();
+    a.grayscale = cv::Mat();
+    data->workFinished = monotonicTime();
     return data;
 }
 
@@ -77,54 +128,74 @@ void DecodeStage(SharedData d)
     d->completedStages << ProcessingStage::Decode;
     d->decoded = d->decoder->decode(d->rawFrame.data());
     if (d->settings->negative) {
+        // Decoders can return images that wrap the frame data, which has
+        // no allocator and must not be modified, so make a new image then.
+        cv::Mat negated;
+        if (d->decoded.u)
+            negated = d->decoded;
         double maxval;
         switch (d->decoded.depth()) {
             case CV_8U:
-                cv::subtract(UINT8_MAX, d->decoded, d->decoded);
+                cv::subtract(UINT8_MAX, d->decoded, negated);
                 break;
             case CV_8S:
-                cv::subtract(INT8_MAX, d->decoded, d->decoded);
+                cv::subtract(INT8_MAX, d->decoded, negated);
                 break;
             case CV_16U:
-                cv::subtract(UINT16_MAX, d->decoded, d->decoded);
+                cv::subtract(UINT16_MAX, d->decoded, negated);
                 break;
             case CV_16S:
-                cv::subtract(INT16_MAX, d->decoded, d->decoded);
+                cv::subtract(INT16_MAX, d->decoded, negated);
                 break;
             case CV_32S:
-                cv::subtract(INT32_MAX, d->decoded, d->decoded);
+                cv::subtract(INT32_MAX, d->decoded, negated);
                 break;
             default:
                 cv::minMaxIdx(d->decoded.reshape(1), nullptr, &maxval);
-                cv::subtract(maxval, d->decoded, d->decoded);
+                cv::subtract(maxval, d->decoded, negated);
         }
+        d->decoded = negated;
+    }
+    // Known frames are only cropped and saved.
+    if (d->known && !d->doRender)
+        return;
+    auto& a = scratch();
+    if (d->decoded.depth() != CV_32F) {
+        d->decoded.convertTo(a.floatBuffer, CV_32F);
+        a.decodedFloat = a.floatBuffer;
+    } else {
+        a.decodedFloat = d->decoded;
     }
-    if (d->decoded.type() != CV_32F)
-        d->decoded.convertTo(d->decodedFloat, CV_32F);
-    else
-        d->decodedFloat = d->decoded;
 
-    if (d->decodedFloat.channels() > 1) {
+    if (a.decodedFloat.channels() > 1) {
 #if CV_VERSION_MAJOR > 3
-        cv::cvtColor(d->decodedFloat, d->grayscale, cv::COLOR_BGR2GRAY);
+        cv::cvtColor(a.decodedFloat, a.grayBuffer, cv::COLOR_BGR2GRAY);
 #else
-        cv::cvtColor(d->decodedFloat, d->grayscale, CV_BGR2GRAY);
+        cv::cvtColor(a.decodedFloat, a.grayBuffer, CV_BGR2GRAY);
 #endif
+        a.grayscale = a.grayBuffer;
     }
     else
-        d->grayscale = d->decodedFloat;
+        a.grayscale = a.decodedFloat;
 }
 
 void CropStage(SharedData d)
 {
     d->completedStages << ProcessingStage::Crop;
 
-    const cv::Mat& m = d->grayscale;
+    if (d->known) {
+        auto& r = d->cropArea;
+        d->cvCropArea = cv::Rect(r.x(), r.y(), r.width(), r.height());
+        d->centroid = QRectF(r).center();
+        return;
+    }
+    const cv::Mat& m = scratch().grayscale;
     QRect imageRect(0, 0, m.cols, m.rows);
     if (!d->settings->doCrop) {
         d->cropArea = imageRect;
         d->cvCropArea = cv::Rect(imageRect.x(), imageRect.y(),
                                  imageRect.width(), imageRect.height());
+        d->centroid = QRectF(imageRect).center();
         return;
     }
 
@@ -141,6 +212,7 @@ void CropStage(SharedData d)
     }
     x /= sum;
     y /= sum;
+    d->centroid = QPointF(x, y);
 
     QRect cropRect(0, 0,
                    d->settings->cropWidth,
@@ -294,8 +366,8 @@ void RenderStage(SharedData d)
         theFunc = renderFrame<false, true>;
         break;
     default:
-        M->convertTo(d->renderTemporary, CV_8U);
-        M = &d->renderTemporary;
+        M->convertTo(scratch().renderTemporary, CV_8U);
+        M = &scratch().renderTemporary;
         theFunc = M->channels() > 1 ?
                   renderFrame<false, true> :
                   renderFrame<true, true>;
@@ -306,22 +378,25 @@ void RenderStage(SharedData d)
 
 void EstimateQualityStage(SharedData d)
 {
+    if (d->known)
+        return;
     if (!d->settings->estimateQuality) {
         d->quality = 0;
         return;
     }
     d->completedStages << ProcessingStage::EstimateQuality;
-    cv::GaussianBlur(d->decodedFloat, d->blurNoise,
+    auto& a = scratch();
+    cv::GaussianBlur(a.decodedFloat, a.blurNoise,
                      cv::Size(0, 0), d->settings->estimatorSettings.noiseSigma);
-    cv::GaussianBlur(d->blurNoise, d->blurSignal,
+    cv::GaussianBlur(a.blurNoise, a.blurSignal,
                      cv::Size(0, 0), d->settings->estimatorSettings.signalSigma);
-    cv::subtract(d->blurNoise, d->blurSignal, d->blurSignal);
-    cv::subtract(d->decodedFloat, d->blurNoise, d->blurNoise);
-    double noise = d->blurNoise.dot(d->blurNoise);
+    cv::subtract(a.blurNoise, a.blurSignal, a.blurSignal);
+    cv::subtract(a.decodedFloat, a.blurNoise, a.blurNoise);
+    double noise = a.blurNoise.dot(a.blurNoise);
     if (noise == 0) {
         d->quality = 0;
     } else {
-        double signal = d->blurSignal.dot(d->blurSignal);
+        double signal = a.blurSignal.dot(a.blurSignal);
         d->quality = signal / noise;
     }
 }
@@ -344,18 +419,58 @@ void SaveStage(SharedData d)
         d->decoded(d->cvCropArea).copyTo(*(d->cloned));
     }
 
-    d->accepted = d->quality >= d->settings->minimumQuality;
+    // Known frames were selected by a previous pass, so they are saved
+    // regardless of how their quality compares to the threshold.
+    d->accepted = d->known || d->quality >= d->settings->minimumQuality;
     bool doSave = d->settings->filterType == QualityFilterType::None ||
                   (d->settings->filterType == QualityFilterType::MinimumQuality && d->accepted);
     doSave = doSave && d->settings->saveImages;
     if (doSave) {
-        if (!saveImage(d->decoded(d->cvCropArea), filename))
+        auto image = d->decoded(d->cvCropArea);
+        if (d->settings->serSink) {
+            if (!d->settings->serSink->write(image, meta.timestamp, d->quality))
+                throw ProcessingException({"Save", "SER video"});
+        } else if (!saveImage(image, filename, d->settings->outputFormat,
+                              meta.timestamp, d->quality)) {
             throw ProcessingException({"Save", "filename " + filename});
+        }
     }
+
+    if (d->settings->saveImages && d->settings->candidates &&
+        d->settings->filterType == QualityFilterType::BestOfAll) {
+        CandidateStore::Candidate c{filename, meta.timestamp, d->quality,
+                                    d->settings->outputFormat};
+        if (!d->settings->candidates->add(d->decoded(d->cvCropArea), c))
+            throw ProcessingException({"Save", "candidate store"});
+    }
+}
+
+QVector<KnownFrame> selectBestFrames(QVector<KnownFrame> frames, int percent,
+                                     float* minQuality)
+{
+    if (frames.isEmpty())
+        return frames;
+    std::sort(frames.begin(), frames.end(),
+              [](const KnownFrame& a, const KnownFrame& b) {
+                  return a.quality < b.quality;
+              });
+    int minIdx = frames.count() * (100 - percent) / 100;
+    minIdx = qBound(0, minIdx, frames.count() - 1);
+    if (minQuality)
+        *minQuality = frames.at(minIdx).quality;
+    frames.remove(0, minIdx);
+    std::sort(frames.begin(), frames.end(),
+              [](const KnownFrame& a, const KnownFrame& b) {
+                  return a.index < b.index;
+              });
+    return frames;
 }
 
-bool saveImage(const cv::Mat& image, QString filename)
+bool saveImage(const cv::Mat& image, QString filename, OutputFormat format,
+               const QDateTime& timestamp, double quality)
 {
+    if (format == OutputFormat::Fits)
+        return Fits::writeImage(image, timestamp, quality, filename + ".fits");
     std::vector<uchar> data;
     bool success = cv::imencode(".tiff", image, data);
     if (success) {
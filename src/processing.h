@@ -23,14 +23,19 @@
 #include <QScopedPointer>
 #include <QSharedPointer>
 #include <QList>
+#include <QVector>
 #include <QRect>
+#include <QPointF>
 #include <QImage>
 #include <QPainterPath>
 #include <QPen>
 #include <opencv2/core/core.hpp>
+#include <algorithm>
 
 class ProcessingData;
 typedef QSharedPointer<ProcessingData> SharedData;
+class SerSink;
+class CandidateStore;
 
 enum class ProcessingStage
 {
@@ -40,23 +45,35 @@ enum class ProcessingStage
     EstimateQuality,
     Save
 };
+static const int processingStageCount = 5;
 
 // Call this using QtConcurrent::run().
 SharedData processData(SharedData data);
 
-// Exported because images can be saved by foreman, depending on filtering type.
-bool saveImage(const cv::Mat& image, QString filename);
-
 enum class QualityFilterType
 {
     None,
     MinimumQuality, // Handled by the saving stage of processing
-    AcceptanceRate  // Handled by the foreman
+    AcceptanceRate, // Handled by the foreman
+    BestOfAll       // Handled by the foreman when processing stops
     // Filtering a whole file is handled by main window, which will
     // first use None and track qualities itself, and then do a second
-    // pass using MinimumQuality.
+    // pass using MinimumQuality. Sequential sources can't be read twice,
+    // so BestOfAll keeps every image in a CandidateStore instead.
 };
 
+enum class OutputFormat
+{
+    Tiff, // An image file per frame
+    Ser,  // All frames in a SER video
+    Fits  // An uncompressed image file per frame
+};
+
+// Exported because images can be saved by foreman, depending on filtering type.
+// The file name is completed with the extension of the format.
+bool saveImage(const cv::Mat& image, QString filename, OutputFormat format,
+               const QDateTime& timestamp, double quality);
+
 struct EstimatorSettings
 {
     double noiseSigma, signalSigma;
@@ -85,13 +102,38 @@ struct ProcessingSettings {
     // Save
     bool saveImages;
     QString saveImagesDirectory;
+    OutputFormat outputFormat;
+    // Set by the foreman while saving to a SER video.
+    QSharedPointer<SerSink> serSink;
+    // Set by the foreman while filtering with BestOfAll.
+    QSharedPointer<CandidateStore> candidates;
     // Filter
     QualityFilterType filterType;
     double minimumQuality;
     int acceptancePercent;
     int filterQueueLength;
+    // Recording of raw frames around good seeing, see RingRecorder.
+    bool ringRecording;
+    double ringSeconds, ringAfterSeconds, ringTrigger;
+    int ringWindow;
+    // Display, every displayInterval frames are rendered
+    bool display;
+    int displayInterval;
 };
 
+// A frame whose crop and quality were found by the first pass of filtering
+// a whole file. The second pass reuses them instead of estimating again.
+struct KnownFrame {
+    qint64 index;
+    float quality;
+    QRect cropArea;
+};
+
+// Picks the given percentage of the best frames and sorts them by index.
+// The lowest accepted quality is stored into minQuality if given.
+QVector<KnownFrame> selectBestFrames(QVector<KnownFrame> frames, int percent,
+                                     float* minQuality = nullptr);
+
 struct Histograms {
     float red[256], green[256], blue[256];
 };
@@ -117,6 +159,9 @@ struct ProcessingException {
  * thus stages shoud reuse cv::Mat memory and similar.
  * reset() will (re)initialize the appropriate fields for reuse,
  * the rest (such as decoder) is Foreman's responsibility.
+ * Full-frame intermediates that are only needed while the frame
+ * is being processed are not kept here, but in a scratch arena
+ * belonging to the processing thread (see processing.cpp).
  */
 struct ProcessingData {
     // A stage will use these for error handling.
@@ -129,23 +174,24 @@ struct ProcessingData {
     QSharedPointer<ProcessingSettings> settings;
     SharedDecoder decoder;
     SharedRawFrame rawFrame;
+    // Position in a seekable video, or -1.
+    qint64 frameIndex;
+    // Crop and quality are known, so they are not computed again.
+    bool known;
 
     // Decode
     cv::Mat decoded;      // Any format
-    cv::Mat decodedFloat; // CV_32FC
-    cv::Mat grayscale;    // CV_32FC
 
     // Crop
     QRect cropArea;
     cv::Rect cvCropArea;
+    QPointF centroid;
 
     // EstimateQuality
-    cv::Mat blurNoise, blurSignal;
     float quality;
 
     // RenderFrame
     bool doRender, onlyRender;
-    cv::Mat renderTemporary;
     QImage renderedFrame;
     QSharedPointer<Histograms> histograms =
         QSharedPointer<Histograms>(new Histograms);
@@ -162,9 +208,20 @@ struct ProcessingData {
     QSharedPointer<cv::Mat> cloned = QSharedPointer<cv::Mat>(new cv::Mat);
     QString filename;
 
+    // Nanoseconds spent in each stage, indexed by ProcessingStage.
+    qint64 stageTimes[processingStageCount];
+    // Monotonic times, see monotonicTime(). The frame arrived from the
+    // reader, was admitted for processing by the foreman and was picked
+    // up and finished by a worker.
+    qint64 arrived, admitted, workStarted, workFinished;
+
     void reset(QSharedPointer<ProcessingSettings> s) {
         completedStages.clear();
+        std::fill_n(stageTimes, processingStageCount, 0);
+        arrived = admitted = workStarted = workFinished = 0;
         settings = s;
+        frameIndex = -1;
+        known = false;
         doRender = false;
         paintObjects.clear();
     }
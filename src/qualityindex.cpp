@@ -0,0 +1,163 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qualityindex.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDataStream>
+#include <QCryptographicHash>
+#include <QSaveFile>
+#include <QDebug>
+
+namespace QualityIndex
+{
+
+static const char magic[] = "ARIFQIDX";
+static const quint32 version = 2;
+static const qint64 headerBytes = 64 * 1024;
+static const qint64 sampleBytes = 4096;
+static const int samples = 64;
+
+static void addFileIdentity(QCryptographicHash& hash, const QFileInfo& info)
+{
+    QByteArray id;
+    QDataStream s(&id, QIODevice::WriteOnly);
+    s << info.fileName() << info.size()
+      << info.lastModified().toMSecsSinceEpoch();
+    hash.addData(id);
+}
+
+// Hashes the start of the file and evenly spaced blocks after it, which
+// is enough to tell recordings apart without reading them whole.
+static bool addFileContents(QCryptographicHash& hash, const QString& path)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+    hash.addData(f.read(headerBytes));
+    qint64 size = f.size();
+    if (size > headerBytes) {
+        qint64 step = (size - headerBytes) / samples;
+        for (int i = 0; i < samples && step > 0; i++) {
+            if (!f.seek(headerBytes + i * step))
+                return false;
+            hash.addData(f.read(sampleBytes));
+        }
+    }
+    return true;
+}
+
+static QByteArray key(const QString& input, const ProcessingSettings& settings)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QFileInfo info(input);
+    if (info.isDir()) {
+        auto filter = QDir::Files | QDir::NoDotAndDotDot;
+        for (auto& file : QDir(input).entryInfoList(filter, QDir::Name))
+            addFileIdentity(hash, file);
+    } else {
+        addFileIdentity(hash, info);
+        if (!addFileContents(hash, input))
+            return QByteArray();
+    }
+
+    QByteArray s;
+    QDataStream stream(&s, QIODevice::WriteOnly);
+    stream << settings.plugin->name() << settings.negative
+           << settings.doCrop << settings.cropWidth << settings.threshold
+           << settings.estimatorSettings;
+    // The format settings of the source, e.g. the frame size of a raw
+    // video, change what the frames look like. Values are compared as
+    // text, since settings files don't keep their types. The input file
+    // itself is identified above.
+    auto& format = settings.plugin->settings;
+    for (auto i = format.constBegin(); i != format.constEnd(); ++i)
+        if (i.key() != "file")
+            stream << i.key() << i.value().toString();
+    hash.addData(s);
+    return hash.result();
+}
+
+QString indexPath(const QString& input)
+{
+    auto path = QFileInfo(input).absoluteFilePath();
+    while (path.endsWith('/') && path.size() > 1)
+        path.chop(1);
+    return path + ".arif-quality";
+}
+
+bool load(const QString& input, const ProcessingSettings& settings,
+          QVector<KnownFrame>* frames)
+{
+    if (input.isEmpty())
+        return false;
+    QFile f(indexPath(input));
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream s(&f);
+    QByteArray fileMagic, fileKey;
+    quint32 fileVersion, count;
+    s >> fileMagic >> fileVersion >> fileKey >> count;
+    if (s.status() != QDataStream::Ok || fileMagic != magic ||
+        fileVersion != version || fileKey != key(input, settings) ||
+        count == 0)
+        return false;
+    // A damaged index must not make us allocate or read for long.
+    quint64 videoFrames = settings.plugin->reader()->numberOfFrames();
+    if (videoFrames > 0 && count > videoFrames)
+        return false;
+    QVector<KnownFrame> loaded;
+    loaded.reserve(qMin<quint64>(count, videoFrames));
+    for (quint32 i = 0; i < count && s.status() == QDataStream::Ok; i++) {
+        KnownFrame frame;
+        s >> frame.index >> frame.quality >> frame.cropArea;
+        loaded << frame;
+    }
+    if (s.status() != QDataStream::Ok)
+        return false;
+    *frames = loaded;
+    return true;
+}
+
+bool save(const QString& input, const ProcessingSettings& settings,
+          const QVector<KnownFrame>& frames)
+{
+    if (input.isEmpty() || frames.isEmpty())
+        return false;
+    auto fileKey = key(input, settings);
+    if (fileKey.isEmpty())
+        return false;
+    // A partially written index is never left behind.
+    QSaveFile f(indexPath(input));
+    if (!f.open(QIODevice::WriteOnly)) {
+        qDebug() << "Cannot write quality index" << f.fileName();
+        return false;
+    }
+    QDataStream s(&f);
+    s << QByteArray(magic) << version << fileKey << quint32(frames.size());
+    for (auto& frame : frames)
+        s << frame.index << frame.quality << frame.cropArea;
+    if (s.status() != QDataStream::Ok || !f.commit()) {
+        qDebug() << "Cannot write quality index" << f.fileName();
+        return false;
+    }
+    return true;
+}
+
+}
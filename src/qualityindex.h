@@ -0,0 +1,51 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUALITYINDEX_H
+#define QUALITYINDEX_H
+
+#include "processing.h"
+#include <QString>
+#include <QVector>
+
+/*
+ * Qualities and crop areas of all frames of a recorded input, kept in a
+ * file next to it. Filtering the same input again with a different
+ * acceptance rate can then skip the first pass. The index is only used
+ * if neither the input nor the settings that affect quality and
+ * cropping changed since it was made. The input is recognized by its
+ * size, modification time and a hash of its header and of blocks
+ * sampled throughout it; a directory by the same of its files.
+ */
+namespace QualityIndex
+{
+
+// The index file belonging to the input.
+QString indexPath(const QString& input);
+
+// Returns false if there is no valid index for the input and settings.
+bool load(const QString& input, const ProcessingSettings& settings,
+          QVector<KnownFrame>* frames);
+
+// The frames must cover the entire input.
+bool save(const QString& input, const ProcessingSettings& settings,
+          const QVector<KnownFrame>& frames);
+
+}
+
+#endif
@@ -0,0 +1,178 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resultsformat.h"
+#include <cstring>
+
+namespace Results
+{
+
+static const char fileMagic[8] = {'A', 'R', 'I', 'F', 'R', 'E', 'S', '1'};
+static const quint32 chunkMagic = 0x4b4e4843; // "CHNK"
+static const quint32 byteOrderMark = 0x01020304;
+static const quint32 version = 1;
+
+static const struct {
+    const char* name;
+    int bytes;
+} columns[ColumnCount] = {
+    {"sequence", 8},
+    {"frame", 8},
+    {"timestamp", 8},
+    {"frameofsecond", 4},
+    {"quality", 4},
+    {"centroidx", 4},
+    {"centroidy", 4},
+    {"cropx", 4},
+    {"cropy", 4},
+    {"cropwidth", 4},
+    {"cropheight", 4},
+    {"accepted", 1},
+    {"decodetime", 4},
+    {"rendertime", 4},
+    {"croptime", 4},
+    {"estimatetime", 4},
+    {"savetime", 4},
+};
+
+int columnBytes(Column c)
+{
+    return columns[c].bytes;
+}
+
+const char* columnName(Column c)
+{
+    return columns[c].name;
+}
+
+static qint64 paddedBytes(Column c, int rows)
+{
+    return (qint64(columnBytes(c)) * rows + 7) / 8 * 8;
+}
+
+QByteArray fileHeader()
+{
+    QByteArray h(fileHeaderSize, 0);
+    auto p = h.data();
+    std::memcpy(p, fileMagic, 8);
+    std::memcpy(p + 8, &version, 4);
+    std::memcpy(p + 12, &byteOrderMark, 4);
+    quint32 count = ColumnCount;
+    std::memcpy(p + 16, &count, 4);
+    return h;
+}
+
+template<typename T, typename F>
+static void appendColumn(QByteArray& out, const QVector<Row>& rows, F get)
+{
+    QByteArray column(rows.size() * sizeof(T), 0);
+    auto p = reinterpret_cast<T*>(column.data());
+    for (auto& r : rows)
+        *p++ = get(r);
+    int padding = (8 - column.size() % 8) % 8;
+    out.append(column).append(QByteArray(padding, 0));
+}
+
+QByteArray encodeChunk(const QVector<Row>& rows)
+{
+    QByteArray chunk(chunkHeaderSize, 0);
+    quint32 count = rows.size();
+    std::memcpy(chunk.data(), &chunkMagic, 4);
+    std::memcpy(chunk.data() + 4, &count, 4);
+    appendColumn<qint64>(chunk, rows, [](const Row& r) { return r.sequence; });
+    appendColumn<qint64>(chunk, rows, [](const Row& r) { return r.frameIndex; });
+    appendColumn<qint64>(chunk, rows, [](const Row& r) { return r.timestamp; });
+    appendColumn<qint32>(chunk, rows, [](const Row& r) { return r.frameOfSecond; });
+    appendColumn<float>(chunk, rows, [](const Row& r) { return r.quality; });
+    appendColumn<float>(chunk, rows, [](const Row& r) { return r.centroidX; });
+    appendColumn<float>(chunk, rows, [](const Row& r) { return r.centroidY; });
+    appendColumn<qint32>(chunk, rows, [](const Row& r) { return r.cropX; });
+    appendColumn<qint32>(chunk, rows, [](const Row& r) { return r.cropY; });
+    appendColumn<qint32>(chunk, rows, [](const Row& r) { return r.cropWidth; });
+    appendColumn<qint32>(chunk, rows, [](const Row& r) { return r.cropHeight; });
+    appendColumn<quint8>(chunk, rows, [](const Row& r) { return r.accepted; });
+    for (int i = 0; i < stageCount; i++)
+        appendColumn<quint32>(chunk, rows,
+                              [i](const Row& r) { return r.stageTimes[i]; });
+    return chunk;
+}
+
+double Chunk::value(Column c, int row) const
+{
+    switch (c) {
+    case Sequence:
+    case FrameIndex:
+    case Timestamp:
+        return column<qint64>(c)[row];
+    case FrameOfSecond:
+    case CropX:
+    case CropY:
+    case CropWidth:
+    case CropHeight:
+        return column<qint32>(c)[row];
+    case Quality:
+    case CentroidX:
+    case CentroidY:
+        return column<float>(c)[row];
+    case Accepted:
+        return column<quint8>(c)[row];
+    default:
+        return column<quint32>(c)[row];
+    }
+}
+
+QString parse(const char* data, qint64 bytes, QVector<Chunk>* chunks)
+{
+    if (bytes < fileHeaderSize || std::memcmp(data, fileMagic, 8) != 0)
+        return "Not a results log.";
+    quint32 fileVersion, order, count;
+    std::memcpy(&fileVersion, data + 8, 4);
+    std::memcpy(&order, data + 12, 4);
+    std::memcpy(&count, data + 16, 4);
+    if (order != byteOrderMark)
+        return "The log was written on a machine with a different byte order.";
+    if (fileVersion != version || count != ColumnCount)
+        return "Unsupported version of the results log.";
+
+    chunks->clear();
+    qint64 offset = fileHeaderSize;
+    while (offset + chunkHeaderSize <= bytes) {
+        quint32 magic, rows;
+        std::memcpy(&magic, data + offset, 4);
+        std::memcpy(&rows, data + offset + 4, 4);
+        if (magic != chunkMagic)
+            return "The results log is damaged.";
+        qint64 end = offset + chunkHeaderSize;
+        for (int c = 0; c < ColumnCount; c++)
+            end += paddedBytes(Column(c), rows);
+        if (end > bytes)
+            break;
+        Chunk chunk;
+        chunk.rows = rows;
+        const char* p = data + offset + chunkHeaderSize;
+        for (int c = 0; c < ColumnCount; c++) {
+            chunk.columns[c] = p;
+            p += paddedBytes(Column(c), rows);
+        }
+        *chunks << chunk;
+        offset = end;
+    }
+    return QString();
+}
+
+}
@@ -0,0 +1,100 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RESULTSFORMAT_H
+#define RESULTSFORMAT_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+/*
+ * The log of per-frame results written into the destination directory,
+ * also when no images are saved. It is columnar so that a single value
+ * of all frames, e.g. the quality, can be read without touching the
+ * rest. A 32-byte file header is followed by chunks that are appended
+ * as frames are processed. A chunk has a 16-byte header giving its
+ * number of rows, followed by one array per column, each padded to 8
+ * bytes. Values are in host byte order, which
+ * is recorded in the file header, and are aligned when the file is
+ * mapped into memory. A truncated last chunk is ignored.
+ */
+namespace Results
+{
+
+static const int fileHeaderSize = 32;
+static const int chunkHeaderSize = 16;
+static const int stageCount = 5; // Same as ProcessingStage.
+
+enum Column {
+    Sequence,      // qint64, order in which frames were logged
+    FrameIndex,    // qint64, position in a seekable video, or -1
+    Timestamp,     // qint64, milliseconds since the epoch
+    FrameOfSecond, // qint32
+    Quality,       // float
+    CentroidX,     // float
+    CentroidY,     // float
+    CropX,         // qint32
+    CropY,         // qint32
+    CropWidth,     // qint32
+    CropHeight,    // qint32
+    Accepted,      // quint8, by minimum quality filtering
+    DecodeTime,    // quint32, microseconds spent in each stage
+    RenderTime,
+    CropTime,
+    EstimateTime,
+    SaveTime,
+    ColumnCount
+};
+
+int columnBytes(Column c);
+const char* columnName(Column c);
+
+struct Row {
+    qint64 sequence;
+    qint64 frameIndex;
+    qint64 timestamp;
+    qint32 frameOfSecond;
+    float quality;
+    float centroidX, centroidY;
+    qint32 cropX, cropY, cropWidth, cropHeight;
+    quint8 accepted;
+    quint32 stageTimes[stageCount];
+};
+
+QByteArray fileHeader();
+QByteArray encodeChunk(const QVector<Row>& rows);
+
+// Columns of a chunk, pointing into the log.
+struct Chunk {
+    int rows;
+    const char* columns[ColumnCount];
+
+    template<typename T> const T* column(Column c) const {
+        return reinterpret_cast<const T*>(columns[c]);
+    }
+    // Reads any column as a double.
+    double value(Column c, int row) const;
+};
+
+// Finds the chunks of a log. Returns an empty string on success.
+QString parse(const char* data, qint64 bytes, QVector<Chunk>* chunks);
+
+}
+
+#endif
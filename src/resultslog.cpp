@@ -0,0 +1,102 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resultslog.h"
+#include "processing.h"
+#include <cstdint>
+
+static const int chunkRows = 1024;
+
+ResultsLog::ResultsLog(QString filename): file(filename)
+{
+    rows.reserve(chunkRows);
+    start();
+}
+
+ResultsLog::~ResultsLog()
+{
+    close();
+}
+
+bool ResultsLog::append(const ProcessingData& d)
+{
+    Results::Row r;
+    r.frameIndex = d.frameIndex;
+    r.timestamp = d.rawFrame->metaData.timestamp.toMSecsSinceEpoch();
+    r.frameOfSecond = d.rawFrame->metaData.frameOfSecond;
+    r.quality = d.quality;
+    r.centroidX = d.centroid.x();
+    r.centroidY = d.centroid.y();
+    r.cropX = d.cropArea.x();
+    r.cropY = d.cropArea.y();
+    r.cropWidth = d.cropArea.width();
+    r.cropHeight = d.cropArea.height();
+    r.accepted = d.accepted;
+    for (int i = 0; i < Results::stageCount; i++)
+        r.stageTimes[i] = qMin<qint64>(d.stageTimes[i] / 1000, UINT32_MAX);
+
+    QMutexLocker lock(&mutex);
+    if (closing || failed)
+        return false;
+    r.sequence = sequence++;
+    rows << r;
+    if (rows.size() >= chunkRows)
+        chunkReady.wakeOne();
+    return true;
+}
+
+bool ResultsLog::close()
+{
+    mutex.lock();
+    closing = true;
+    chunkReady.wakeAll();
+    mutex.unlock();
+    wait();
+    QMutexLocker lock(&mutex);
+    return !failed;
+}
+
+void ResultsLog::run()
+{
+    bool ok = file.open(QIODevice::WriteOnly) &&
+              file.write(Results::fileHeader()) == Results::fileHeaderSize;
+    QMutexLocker lock(&mutex);
+    failed = !ok;
+    forever {
+        while (rows.size() < chunkRows && !closing)
+            chunkReady.wait(&mutex);
+        if (rows.isEmpty())
+            break;
+        QVector<Results::Row> pending;
+        pending.swap(rows);
+        rows.reserve(chunkRows);
+        lock.unlock();
+        if (ok) {
+            auto chunk = Results::encodeChunk(pending);
+            // Flushed right away, so that the log can be read while
+            // processing continues.
+            ok = file.write(chunk) == chunk.size() && file.flush();
+        }
+        lock.relock();
+        failed = failed || !ok;
+    }
+    lock.unlock();
+    file.close();
+    lock.relock();
+    failed = failed || !ok;
+}
@@ -0,0 +1,61 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RESULTSLOG_H
+#define RESULTSLOG_H
+
+#include "resultsformat.h"
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QFile>
+
+struct ProcessingData;
+
+/*
+ * Writes the results of processed frames into a log, see resultsformat.h.
+ * Rows are collected into chunks, which are written by a thread of the
+ * log's own, so that the foreman never waits for the disk.
+ */
+class ResultsLog: public QThread
+{
+public:
+    explicit ResultsLog(QString filename);
+    ~ResultsLog();
+
+    // Queues the results of the frame. Returns false if writing has failed.
+    bool append(const ProcessingData& d);
+
+    // Writes the queued rows and stops the thread. Returns false if any
+    // writing failed.
+    bool close();
+
+protected:
+    void run();
+
+private:
+    QMutex mutex;
+    QWaitCondition chunkReady;
+    QVector<Results::Row> rows;
+    qint64 sequence = 0;
+    bool closing = false;
+    bool failed = false;
+    QFile file;
+};
+
+#endif
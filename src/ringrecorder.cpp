@@ -0,0 +1,187 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ringrecorder.h"
+#include "sersink.h"
+#include <QDebug>
+#include <cmath>
+#include <limits>
+
+// Frames beyond this are dropped if the disk can't keep up.
+static const int maxQueuedFrames = 4096;
+// Assumed when the frame rate of the source is not known yet.
+static const double fallbackFrameRate = 200;
+// The ring has room for this much faster frames than expected.
+static const double rateMargin = 1.5;
+
+RingRecorder::RingRecorder(QString directory_, double secondsBefore,
+                           double secondsAfter, double trigger_, int window,
+                           double frameRate):
+    directory(directory_), before(secondsBefore * 1e9),
+    after(secondsAfter * 1e9), trigger(trigger_), qualities(qMax(window, 1))
+{
+    if (frameRate <= 0)
+        frameRate = fallbackFrameRate;
+    ring.resize(qMax(2, (int)std::ceil(secondsBefore * frameRate * rateMargin)));
+    start();
+}
+
+RingRecorder::~RingRecorder()
+{
+    close();
+}
+
+void RingRecorder::addFrame(SharedRawFrame frame)
+{
+    lastArrival = frame->metaData.arrival;
+    lastTimestamp = frame->metaData.timestamp;
+    if (recording) {
+        if (lastArrival <= recordUntil) {
+            enqueue({frame, QString()});
+            return;
+        }
+        recording = false;
+    }
+    if (ringSize == ring.size()) {
+        // Faster than expected, so the kept time is a bit shorter.
+        ring[ringStart].clear();
+        ringStart = (ringStart + 1) % ring.size();
+        ringSize--;
+    }
+    ring[(ringStart + ringSize) % ring.size()] = frame;
+    ringSize++;
+    qint64 oldest = lastArrival - before;
+    while (ringSize > 0 && ring[ringStart]->metaData.arrival < oldest) {
+        ring[ringStart].clear();
+        ringStart = (ringStart + 1) % ring.size();
+        ringSize--;
+    }
+}
+
+void RingRecorder::addQuality(float quality)
+{
+    if (qualityCount == qualities.size())
+        qualitySum -= qualities[qualityPosition];
+    else
+        qualityCount++;
+    qualities[qualityPosition] = quality;
+    qualityPosition = (qualityPosition + 1) % qualities.size();
+    qualitySum += quality;
+    if (qualitySum / qualityCount < trigger || lastTimestamp.isNull())
+        return;
+    if (!recording)
+        startRecording();
+    recordUntil = lastArrival + after;
+}
+
+void RingRecorder::startRecording()
+{
+    auto name = QString("%1/arif-ring-%2")
+                .arg(directory)
+                .arg(lastTimestamp.toLocalTime().toString("yyyyMMdd-hhmmsszzz"));
+    for (int i = 0; i < ringSize; i++) {
+        auto& frame = ring[(ringStart + i) % ring.size()];
+        enqueue({frame, i == 0 ? name : QString()});
+        frame.clear();
+    }
+    if (ringSize == 0)
+        enqueue({SharedRawFrame(), name});
+    ringStart = ringSize = 0;
+    recording = true;
+}
+
+void RingRecorder::enqueue(const Item& item_)
+{
+    Item item = item_;
+    if (item.frame) {
+        // Decoders are created in the foreman's thread, like for processing.
+        if (!decoder || decoder->plugin() != item.frame->plugin())
+            decoder = item.frame->plugin()->createDecoder();
+        item.decoder = decoder;
+    }
+    QMutexLocker lock(&mutex);
+    // A new recording is never dropped, it may end the previous one.
+    if (queue.size() >= maxQueuedFrames && item.newFile.isEmpty()) {
+        dropped++;
+        return;
+    }
+    queue.enqueue(item);
+    itemAdded.wakeOne();
+}
+
+bool RingRecorder::close()
+{
+    mutex.lock();
+    closing = true;
+    itemAdded.wakeAll();
+    mutex.unlock();
+    wait();
+    QMutexLocker lock(&mutex);
+    if (dropped > 0)
+        qDebug() << "Ring recorder dropped" << dropped << "frames.";
+    dropped = 0;
+    return !failed;
+}
+
+void RingRecorder::run()
+{
+    QMutexLocker lock(&mutex);
+    forever {
+        while (queue.isEmpty() && !closing)
+            itemAdded.wait(&mutex);
+        if (queue.isEmpty())
+            break;
+        QQueue<Item> items;
+        items.swap(queue);
+        bool ok = !failed;
+        lock.unlock();
+        for (auto& item: items)
+            ok = write(item) && ok;
+        lock.relock();
+        failed = !ok;
+    }
+    lock.unlock();
+    bool ok = finishRecording();
+    lock.relock();
+    failed = failed || !ok;
+}
+
+bool RingRecorder::write(const Item& item)
+{
+    bool ok = true;
+    if (!item.newFile.isEmpty()) {
+        ok = finishRecording();
+        // Writes <newFile>.ser and <newFile>.csv.
+        sink.reset(new SerSink(item.newFile));
+    }
+    if (!item.frame || !sink)
+        return ok;
+    cv::Mat image = item.decoder->decode(item.frame.data());
+    if (image.empty())
+        return false;
+    // The quality of the recorded frames isn't known here.
+    return sink->write(image, item.frame->metaData.timestamp,
+                       std::numeric_limits<float>::quiet_NaN()) && ok;
+}
+
+bool RingRecorder::finishRecording()
+{
+    bool ok = !sink || sink->close();
+    sink.reset();
+    return ok;
+}
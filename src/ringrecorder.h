@@ -0,0 +1,99 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RINGRECORDER_H
+#define RINGRECORDER_H
+
+#include "videosources/interfaces.h"
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QVector>
+#include <QScopedPointer>
+
+class SerSink;
+
+/*
+ * Keeps the raw frames of the last few seconds of a live source, without
+ * decoding them. When the average quality of recent frames reaches the
+ * trigger, the kept frames and the ones that follow are written to disk,
+ * until the quality has stayed below the trigger for the given time.
+ * Each such recording is a separate SER video, so that it can be processed
+ * later like any other. The frames are decoded and handed to a SerSink by
+ * a thread of the recorder's own.
+ */
+class RingRecorder: public QThread
+{
+public:
+    // The frame rate of the source, if known, sets the size of the ring,
+    // which doesn't grow afterwards.
+    RingRecorder(QString directory, double secondsBefore, double secondsAfter,
+                 double trigger, int window, double frameRate);
+    ~RingRecorder();
+
+    // These two are called by the foreman for every frame received and
+    // every quality estimated.
+    void addFrame(SharedRawFrame frame);
+    void addQuality(float quality);
+
+    // Writes the queued frames and stops the thread. Returns false if
+    // any writing failed.
+    bool close();
+
+protected:
+    void run();
+
+private:
+    struct Item {
+        SharedRawFrame frame;
+        SharedDecoder decoder;
+        QString newFile; // Starts a new recording if not empty.
+    };
+
+    void enqueue(const Item& item);
+    void startRecording();
+    // Used by the writing thread only.
+    bool write(const Item& item);
+    bool finishRecording();
+
+    // Used by the foreman's thread only.
+    QString directory;
+    qint64 before, after; // Nanoseconds of arrival times.
+    double trigger;
+    SharedDecoder decoder;
+    QVector<SharedRawFrame> ring; // Circular, the oldest frame is overwritten.
+    int ringStart = 0, ringSize = 0;
+    QVector<float> qualities;
+    int qualityPosition = 0, qualityCount = 0;
+    double qualitySum = 0;
+    bool recording = false;
+    qint64 lastArrival = 0, recordUntil = 0;
+    QDateTime lastTimestamp; // Names the recordings.
+
+    QMutex mutex;
+    QWaitCondition itemAdded;
+    QQueue<Item> queue;
+    bool closing = false;
+    bool failed = false;
+    int dropped = 0;
+
+    QScopedPointer<SerSink> sink;
+};
+
+#endif
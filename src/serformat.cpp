@@ -0,0 +1,107 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "serformat.h"
+#include <QtEndian>
+#include <cstring>
+
+using namespace Ser;
+
+static const char fileId[] = "LUCAM-RECORDER";
+static const int fileIdBytes = 14;
+static const int stringBytes = 40;
+// Ticks between 0001-01-01 and the Unix epoch.
+static const qint64 epochTicks = 621355968000000000ll;
+static const qint64 ticksPerMsec = 10000;
+
+QString Header::parse(const char* data, qint64 bytes)
+{
+    if (bytes < size)
+        return "File is too short to be a SER video.";
+    if (memcmp(data, fileId, fileIdBytes) != 0)
+        return "File is not a SER video.";
+    auto p = reinterpret_cast<const uchar*>(data) + fileIdBytes;
+    auto int32 = [&p]() { auto v = qFromLittleEndian<qint32>(p); p += 4; return v; };
+    auto int64 = [&p]() { auto v = qFromLittleEndian<qint64>(p); p += 8; return v; };
+    auto string = [&p]() {
+        auto s = reinterpret_cast<const char*>(p);
+        p += stringBytes;
+        return QByteArray(s, qstrnlen(s, stringBytes));
+    };
+    luId = int32();
+    colorId = int32();
+    littleEndian = int32();
+    width = int32();
+    height = int32();
+    pixelDepth = int32();
+    frameCount = int32();
+    observer = string();
+    instrument = string();
+    telescope = string();
+    dateTime = int64();
+    dateTimeUtc = int64();
+
+    if (width <= 0 || height <= 0 || frameCount < 0)
+        return "Invalid SER header.";
+    if (pixelDepth < 1 || pixelDepth > 16)
+        return "Unsupported SER pixel depth.";
+    return QString{};
+}
+
+QByteArray Header::serialize() const
+{
+    QByteArray h(size, 0);
+    memcpy(h.data(), fileId, fileIdBytes);
+    auto p = reinterpret_cast<uchar*>(h.data()) + fileIdBytes;
+    auto int32 = [&p](qint32 v) { qToLittleEndian(v, p); p += 4; };
+    auto int64 = [&p](qint64 v) { qToLittleEndian(v, p); p += 8; };
+    auto string = [&p](const QByteArray& s) {
+        memcpy(p, s.constData(), qMin(s.size(), stringBytes));
+        p += stringBytes;
+    };
+    int32(luId);
+    int32(colorId);
+    int32(littleEndian);
+    int32(width);
+    int32(height);
+    int32(pixelDepth);
+    int32(frameCount);
+    string(observer);
+    string(instrument);
+    string(telescope);
+    int64(dateTime);
+    int64(dateTimeUtc);
+    return h;
+}
+
+QDateTime Ser::fromTicks(qint64 ticks)
+{
+    return QDateTime::fromMSecsSinceEpoch((ticks - epochTicks) / ticksPerMsec,
+                                          Qt::UTC);
+}
+
+qint64 Ser::toTicks(const QDateTime& time)
+{
+    return time.toMSecsSinceEpoch() * ticksPerMsec + epochTicks;
+}
+
+qint64 Ser::toLocalTicks(const QDateTime& time)
+{
+    qint64 offset = time.toLocalTime().offsetFromUtc();
+    return toTicks(time) + offset * 1000 * ticksPerMsec;
+}
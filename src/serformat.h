@@ -0,0 +1,82 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERFORMAT_H
+#define SERFORMAT_H
+
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+
+/*
+ * The SER video format, as written by planetary capture programs. A file
+ * consists of a 178-byte header, the frames and an optional trailer of
+ * per-frame UTC timestamps. All header fields are little endian.
+ */
+namespace Ser
+{
+
+enum ColorId {
+    Mono = 0,
+    BayerRGGB = 8,
+    BayerGRBG = 9,
+    BayerGBRG = 10,
+    BayerBGGR = 11,
+    BayerCYYM = 16,
+    BayerYCMY = 17,
+    BayerYMCY = 18,
+    BayerMYYC = 19,
+    RGB = 100,
+    BGR = 101
+};
+
+struct Header {
+    static const int size = 178;
+
+    qint32 luId = 0;
+    qint32 colorId = Mono;
+    // The specification says that 1 means little endian 16-bit data, but
+    // capture programs write 0 for little endian, and so do we.
+    qint32 littleEndian = 0;
+    qint32 width = 0, height = 0;
+    qint32 pixelDepth = 8; // Bits per plane.
+    qint32 frameCount = 0;
+    QByteArray observer, instrument, telescope; // Up to 40 characters.
+    qint64 dateTime = 0, dateTimeUtc = 0;       // In ticks, see below.
+
+    // Returns an empty string on success.
+    QString parse(const char* data, qint64 bytes);
+    QByteArray serialize() const;
+
+    int planes() const { return colorId >= RGB ? 3 : 1; }
+    int bytesPerSample() const { return pixelDepth > 8 ? 2 : 1; }
+    qint64 frameBytes() const {
+        return qint64(width) * height * planes() * bytesPerSample();
+    }
+    bool isBigEndian() const { return bytesPerSample() > 1 && littleEndian; }
+};
+
+// Timestamps are in 100 ns ticks since midnight of January 1st, year 1.
+QDateTime fromTicks(qint64 ticks);
+qint64 toTicks(const QDateTime& time);
+// The same, but counting in the local time zone, for the DateTime field.
+qint64 toLocalTicks(const QDateTime& time);
+
+}
+
+#endif
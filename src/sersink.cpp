@@ -0,0 +1,189 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sersink.h"
+#include <QtEndian>
+#include <cstring>
+extern "C" {
+#include <fcntl.h>
+}
+
+// Producers wait when this much image data is waiting to be written.
+static const size_t maxQueuedBytes = 256 * 1024 * 1024;
+static const int bufferBytes = 8 * 1024 * 1024;
+static const qint64 preallocationBytes = 256 * 1024 * 1024;
+
+SerSink::SerSink(QString prefix_): prefix(prefix_)
+{
+    start();
+}
+
+SerSink::~SerSink()
+{
+    close();
+}
+
+bool SerSink::write(const cv::Mat& image, const QDateTime& timestamp,
+                    float quality)
+{
+    Item item{image.clone(), timestamp, quality};
+    size_t bytes = item.image.total() * item.image.elemSize();
+    QMutexLocker lock(&mutex);
+    while (!closing && !failed && queuedBytes > maxQueuedBytes)
+        itemTaken.wait(&mutex);
+    if (closing || failed)
+        return false;
+    queue.enqueue(item);
+    queuedBytes += bytes;
+    itemAdded.wakeOne();
+    return true;
+}
+
+bool SerSink::close()
+{
+    mutex.lock();
+    closing = true;
+    itemAdded.wakeAll();
+    itemTaken.wakeAll();
+    mutex.unlock();
+    wait();
+    QMutexLocker lock(&mutex);
+    return !failed;
+}
+
+void SerSink::run()
+{
+    QMutexLocker lock(&mutex);
+    forever {
+        while (queue.isEmpty() && !closing)
+            itemAdded.wait(&mutex);
+        if (queue.isEmpty())
+            break;
+        QQueue<Item> items;
+        items.swap(queue);
+        queuedBytes = 0;
+        itemTaken.wakeAll();
+        bool ok = !failed;
+        lock.unlock();
+        for (auto& item: items)
+            ok = ok && append(item);
+        lock.relock();
+        failed = !ok;
+    }
+    lock.unlock();
+    bool ok = finishFile();
+    lock.relock();
+    failed = failed || !ok;
+}
+
+bool SerSink::append(const Item& item)
+{
+    if (!file.isOpen() || item.image.type() != imageType ||
+        item.image.cols != header.width || item.image.rows != header.height) {
+        if (!finishFile() || !openFile(item.image))
+            return false;
+    }
+    int bytes = item.image.total() * item.image.elemSize();
+    if (buffer.size() + bytes > bufferBytes && !flushBuffer())
+        return false;
+    buffer.append(reinterpret_cast<const char*>(item.image.data), bytes);
+    if (header.frameCount == 0) {
+        header.dateTime = Ser::toLocalTicks(item.timestamp);
+        header.dateTimeUtc = Ser::toTicks(item.timestamp.toUTC());
+    }
+    header.frameCount++;
+    timestamps << Ser::toTicks(item.timestamp.toUTC());
+    index << header.frameCount - 1 << ','
+          << item.timestamp.toUTC().toString(Qt::ISODateWithMs) << ','
+          << item.quality << '\n';
+    return true;
+}
+
+bool SerSink::openFile(const cv::Mat& image)
+{
+    Ser::Header h;
+    int depth = image.depth();
+    if ((depth != CV_8U && depth != CV_16U) ||
+        (image.channels() != 1 && image.channels() != 3))
+        return false;
+    h.colorId = image.channels() == 3 ? Ser::BGR : Ser::Mono;
+    h.pixelDepth = depth == CV_8U ? 8 : 16;
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    h.littleEndian = 1;
+#endif
+    h.width = image.cols;
+    h.height = image.rows;
+    h.instrument = "arif";
+
+    QString name = fileNumber == 0 ? prefix : prefix + QString("-%1").arg(fileNumber + 1);
+    fileNumber++;
+    file.setFileName(name + ".ser");
+    indexFile.setFileName(name + ".csv");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Unbuffered) ||
+        !indexFile.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+    index.setDevice(&indexFile);
+    index << "frame,timestamp,quality\n";
+    header = h;
+    imageType = image.type();
+    timestamps.clear();
+    buffer.reserve(bufferBytes);
+    // The header is written again with the frame count when finished.
+    fileBytes = file.write(header.serialize());
+    allocated = 0;
+    return fileBytes == Ser::Header::size;
+}
+
+bool SerSink::flushBuffer()
+{
+    if (buffer.isEmpty())
+        return true;
+    qint64 end = fileBytes + buffer.size();
+    if (end > allocated) {
+        // Reserve space ahead of the writes to keep the file contiguous.
+        // Not all file systems support this, and it isn't required.
+        allocated = end + preallocationBytes;
+        posix_fallocate(file.handle(), 0, allocated);
+    }
+    bool ok = file.write(buffer) == buffer.size();
+    fileBytes = end;
+    buffer.resize(0); // Keeps the reserved capacity, unlike clear().
+    return ok;
+}
+
+bool SerSink::finishFile()
+{
+    if (!file.isOpen())
+        return true;
+    bool ok = flushBuffer();
+    QByteArray trailer(timestamps.size() * 8, 0);
+    auto p = reinterpret_cast<uchar*>(trailer.data());
+    for (auto t: timestamps) {
+        qToLittleEndian(t, p);
+        p += 8;
+    }
+    ok = ok && file.write(trailer) == trailer.size();
+    ok = ok && file.resize(fileBytes + trailer.size());
+    ok = ok && file.seek(0) && file.write(header.serialize()) == Ser::Header::size;
+    file.close();
+    index.flush();
+    ok = ok && index.status() == QTextStream::Ok;
+    index.setDevice(nullptr);
+    indexFile.close();
+    return ok;
+}
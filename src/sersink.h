@@ -0,0 +1,91 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERSINK_H
+#define SERSINK_H
+
+#include "serformat.h"
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QFile>
+#include <QTextStream>
+#include <QVector>
+#include <opencv2/core/core.hpp>
+
+/*
+ * Appends saved images to a SER video instead of writing a file per image.
+ * Images are queued by the processing threads and written by a thread of
+ * its own in large sequential blocks, into a file that is preallocated
+ * ahead of the writes. When the file is finished, the timestamps are
+ * written into its trailer and a CSV file with the same name lists the
+ * quality of each frame. All frames of a SER video have the same size and
+ * format, so a new file is started whenever these change.
+ */
+class SerSink: public QThread
+{
+public:
+    // Files are named <prefix>.ser, then <prefix>-2.ser and so on.
+    explicit SerSink(QString prefix);
+    ~SerSink();
+
+    // Queues a copy of the image, waiting if too much data is queued.
+    // Thread safe. Returns false if writing has failed or the sink is closed.
+    bool write(const cv::Mat& image, const QDateTime& timestamp, float quality);
+
+    // Writes the queued images, finishes the file and stops the thread.
+    // Returns false if any writing failed.
+    bool close();
+
+protected:
+    void run();
+
+private:
+    struct Item {
+        cv::Mat image;
+        QDateTime timestamp;
+        float quality;
+    };
+
+    // Used by the writing thread only.
+    bool append(const Item& item);
+    bool openFile(const cv::Mat& image);
+    bool finishFile();
+    bool flushBuffer();
+
+    QMutex mutex;
+    QWaitCondition itemAdded, itemTaken;
+    QQueue<Item> queue;
+    size_t queuedBytes = 0;
+    bool closing = false;
+    bool failed = false;
+
+    QString prefix;
+    int fileNumber = 0;
+    QFile file, indexFile;
+    QTextStream index;
+    Ser::Header header;
+    int imageType = -1;
+    QVector<qint64> timestamps;
+    QByteArray buffer;      // Frames not yet written.
+    qint64 fileBytes = 0;   // Bytes written so far.
+    qint64 allocated = 0;   // Bytes preallocated.
+};
+
+#endif
@@ -20,6 +20,7 @@
 #include <qarvgui.h>
 #include <QVBoxLayout>
 #include <QLayout>
+#include <QThreadPool>
 
 using namespace Aravis;
 
@@ -95,7 +96,7 @@ void AravisReader::getFrame(QByteArray frame)
     auto f = new AravisFrame;
     f->frame = frame;
     f->metaData = makeMetaData();
-    emit frameReady(SharedRawFrame(f));
+    deliverFrame(SharedRawFrame(f));
 }
 
 AravisSource* AravisSource::instance;
@@ -104,10 +105,7 @@ AravisSource::AravisSource(QObject* parent):
     QObject(parent), reader_(new AravisReader)
 {
     AravisSource::instance = this;
-    auto a = dynamic_cast<QApplication*>(QApplication::instance());
-    Q_CHECK_PTR(a);
     QArvCamera::init();
-    QArvGui::init(a);
 }
 
 QString AravisSource::name()
@@ -122,7 +120,7 @@ QString AravisSource::readableName()
 
 QString AravisSource::settingsGroup()
 {
-    return "";
+    return "format_" + AravisSource::instance->name();
 }
 
 QString AravisSource::initialize(QString overrideInput)
@@ -148,6 +146,15 @@ SharedRawFrame AravisSource::createRawFrame()
 VideoSourceConfigurationWidget*
 AravisSource::createConfigurationWidget()
 {
+    // Plugins are also instantiated without a GUI, e.g. for batch
+    // processing, so the GUI is only set up once it is needed.
+    static bool guiInitialized = false;
+    if (!guiInitialized) {
+        auto a = dynamic_cast<QApplication*>(QApplication::instance());
+        Q_CHECK_PTR(a);
+        QArvGui::init(a);
+        guiInitialized = true;
+    }
     return new AravisSourceConfigWidget();
 }
 
@@ -168,6 +175,14 @@ void AravisSourceConfigWidget::finish()
     s->size = c->getROI().size();
     s->pixfmt = c->getPixelFormatId();
     disconnect(gui, SIGNAL(recordingToggled(bool)), this, SLOT(finish()));
+    // Frames are copied out of the stream buffers, so the buffers only
+    // need to cover the time until the reader gets to them. Bursts that
+    // arrive while the workers are busy with as many frames as the
+    // foreman allows are absorbed by the default.
+    s->readSettings();
+    int defaultBuffers = 2 * QThreadPool::globalInstance()->maxThreadCount() + 4;
+    int buffers = s->settings.value("stream_buffers", defaultBuffers).toInt();
+    c->setFrameQueueSize(qMax(buffers, 2));
     gui->forceRecording();
     s->reader_->camera = c;
     connect(c, SIGNAL(frameReady(QByteArray, ArvBuffer*)),
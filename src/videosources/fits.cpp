@@ -0,0 +1,339 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "videosources/fits.h"
+#include <QFormLayout>
+#include <QFileInfo>
+#include <QFileDialog>
+#include <QDir>
+#include <QPushButton>
+#include <QMessageBox>
+#include <QThreadPool>
+#include <cstring>
+
+using namespace FitsVideo;
+
+FitsSource* FitsSource::instance;
+
+FitsSource::FitsSource(QObject* parent): QObject(parent)
+{
+    instance = this;
+}
+
+SharedRawFrame FitsFrame::copy()
+{
+    auto f = new FitsFrame;
+    f->header = header;
+    f->frame.resize(dataBytes());
+    memcpy(f->frame.data(), constData(), dataBytes());
+    f->metaData = metaData;
+    return SharedRawFrame(f);
+}
+
+VideoSourcePlugin* FitsFrame::plugin()
+{
+    return FitsSource::instance;
+}
+
+void FitsFrame::serialize(QDataStream& s)
+{
+    s << header.serialize();
+    s.writeRawData(constData(), dataBytes());
+    RawFrame::serialize(s);
+}
+
+void FitsFrame::load(QDataStream& s)
+{
+    QByteArray h;
+    s >> h;
+    header.parse(h.constData(), h.size());
+    mapping.clear();
+    mapped = nullptr;
+    frame.resize(dataBytes());
+    s.readRawData(frame.data(), dataBytes());
+    RawFrame::load(s);
+}
+
+const cv::Mat FitsDecoder::decode(RawFrame* in)
+{
+    auto f = static_cast<FitsFrame*>(in);
+    auto& h = f->header;
+    if (h.planes() == 1) {
+        Fits::readPlane(f->constData(), h, image);
+        return image;
+    }
+    // RGB planes to BGR.
+    for (int c = 0; c < 3; c++)
+        Fits::readPlane(f->constData() + c * h.planeBytes(), h, planes[2 - c]);
+    cv::merge(planes, 3, image);
+    return image;
+}
+
+VideoSourcePlugin* FitsDecoder::plugin()
+{
+    return FitsSource::instance;
+}
+
+FitsReader::FitsReader(const QStringList& files_, const Fits::Header& first_,
+                       SharedMappedFile cube_):
+    files(files_), first(first_), cube(cube_)
+{
+    if (cube) {
+        frames = first.planes();
+        // Frames of the cube are single planes.
+        first.naxis = 2;
+        cube->adviseSequential();
+    } else {
+        frames = files.size();
+    }
+}
+
+bool FitsReader::seek(qint64 frame)
+{
+    if (frame < 0 || frame > frames)
+        return false;
+    position = frame;
+    advisedUntil = frame;
+    return true;
+}
+
+bool FitsReader::isSequential()
+{
+    return false;
+}
+
+quint64 FitsReader::numberOfFrames()
+{
+    return frames;
+}
+
+VideoSourcePlugin* FitsReader::plugin()
+{
+    return FitsSource::instance;
+}
+
+QString FitsReader::readFile(FitsFrame* f, const QString& filename)
+{
+    auto mapping = SharedMappedFile(new MappedFile(filename));
+    if (!mapping->isValid())
+        return "File error: " + filename + " is not readable.";
+    auto error = f->header.parse(mapping->data(), mapping->size());
+    if (!error.isEmpty())
+        return "File error: " + filename + ": " + error;
+    auto& h = f->header;
+    if (h.width() != first.width() || h.height() != first.height() ||
+        h.planes() != first.planes())
+        return "File error: " + filename + " differs in size from the first image.";
+    if (mapping->size() < h.dataOffset + f->dataBytes())
+        return "File error: " + filename + " is truncated.";
+    f->mapping = mapping;
+    f->mapped = mapping->data() + h.dataOffset;
+    return QString{};
+}
+
+void FitsReader::readFrame()
+{
+    if (position >= frames) {
+        deliverAtEnd();
+        return;
+    }
+    auto f = new FitsFrame;
+    SharedRawFrame frame(f);
+    if (cube) {
+        qint64 bytes = first.planeBytes();
+        // Same read-ahead scheme as the SER video reader.
+        qint64 window = 2 * QThreadPool::globalInstance()->maxThreadCount();
+        if (position + window / 2 >= advisedUntil) {
+            qint64 from = qMax(advisedUntil, position);
+            advisedUntil = position + window;
+            cube->adviseWillNeed(first.dataOffset + from * bytes,
+                                 (advisedUntil - from) * bytes);
+        }
+        f->header = first;
+        f->mapping = cube;
+        f->mapped = cube->data() + first.dataOffset + position * bytes;
+    } else {
+        auto error = readFile(f, files.at(position));
+        if (!error.isEmpty()) {
+            deliverError(error);
+            return;
+        }
+    }
+    auto& h = f->header;
+    f->metaData = !cube && h.dateObs.isValid() ? makeMetaData(h.dateObs) :
+                  makeMetaData();
+    position++;
+    deliverFrame(frame);
+}
+
+FitsSourceConfigWidget::FitsSourceConfigWidget() :
+    VideoSourceConfigurationWidget("FITS image configuration")
+{
+    auto layout = new QFormLayout(this);
+    auto inputRow = new QHBoxLayout();
+    path = new QLineEdit();
+    auto openFileDialog = new QPushButton("File");
+    auto openDirectoryDialog = new QPushButton("Directory");
+    auto fileIcon = QIcon::fromTheme("document-open");
+    if (!fileIcon.isNull()) {
+        openFileDialog->setText("");
+        openFileDialog->setIcon(fileIcon);
+    }
+    auto directoryIcon = QIcon::fromTheme("folder-open");
+    if (!directoryIcon.isNull()) {
+        openDirectoryDialog->setText("");
+        openDirectoryDialog->setIcon(directoryIcon);
+    }
+    inputRow->addWidget(path);
+    inputRow->addWidget(openFileDialog);
+    inputRow->addWidget(openDirectoryDialog);
+    layout->addRow("Cube or directory:", inputRow);
+    this->connect(openFileDialog, SIGNAL(clicked(bool)), SLOT(getFile()));
+    this->connect(openDirectoryDialog, SIGNAL(clicked(bool)), SLOT(getDirectory()));
+
+    auto finishButton = new QPushButton("Finish");
+    layout->addRow(finishButton);
+    this->connect(finishButton, SIGNAL(clicked(bool)), SLOT(checkConfig()));
+    restoreConfig();
+}
+
+void FitsSourceConfigWidget::checkConfig()
+{
+    FitsSource* s = FitsSource::instance;
+    saveConfig();
+    auto result = s->initialize();
+    if (result.isNull()) {
+        s->saveSettings();
+        emit configurationComplete();
+    } else {
+        QMessageBox tmp;
+        tmp.setWindowTitle("Error");
+        tmp.setText(result);
+        tmp.exec();
+    }
+}
+
+void FitsSourceConfigWidget::getFile()
+{
+    auto tmp = QFileDialog::getOpenFileName(this,
+                                            "Open FITS file",
+                                            path->text(),
+                                            "FITS images (*.fits *.fit *.fts *.FITS *.FIT *.FTS)");
+    if (!tmp.isNull())
+        path->setText(tmp);
+}
+
+void FitsSourceConfigWidget::getDirectory()
+{
+    auto selected = QFileDialog::getExistingDirectory(this,
+                    "Open directory of FITS images", path->text());
+    if (!selected.isNull())
+        path->setText(selected);
+}
+
+void FitsSourceConfigWidget::saveConfig()
+{
+    auto s = FitsSource::instance;
+    s->settings.insert("path", path->text());
+}
+
+void FitsSourceConfigWidget::restoreConfig()
+{
+    auto s = FitsSource::instance;
+    s->readSettings();
+    path->setText(s->settings.value("path").toString());
+}
+
+QString FitsSource::name()
+{
+    return "FITS";
+}
+
+QString FitsSource::readableName()
+{
+    return "FITS images or data cube";
+}
+
+VideoSourceConfigurationWidget* FitsSource::createConfigurationWidget()
+{
+    return new FitsSourceConfigWidget;
+}
+
+SharedDecoder FitsSource::createDecoder()
+{
+    return SharedDecoder(new FitsDecoder);
+}
+
+SharedRawFrame FitsSource::createRawFrame()
+{
+    return SharedRawFrame(new FitsFrame);
+}
+
+Reader* FitsSource::reader()
+{
+    return reader_.data();
+}
+
+QString FitsSource::settingsGroup()
+{
+    return "format_" + FitsSource::instance->name();
+}
+
+static QStringList fitsFilesInDirectory(QString directory)
+{
+    QDir dir(directory);
+    QStringList filters {"*.fits", "*.fit", "*.fts"};
+    dir.setNameFilters(filters);
+    QStringList files(dir.entryList(QDir::Files, QDir::Name | QDir::IgnoreCase));
+    QStringList absFiles;
+    for (auto& f : files)
+        absFiles << dir.absoluteFilePath(f);
+    return absFiles;
+}
+
+QString FitsSource::initialize(QString overrideInput)
+{
+    auto path = overrideInput.isNull() ? settings.value("path").toString() : overrideInput;
+    QStringList files;
+    SharedMappedFile mapping;
+    if (QFileInfo(path).isDir()) {
+        files = fitsFilesInDirectory(path);
+        if (files.isEmpty())
+            return "Directory error: Selected directory contains no FITS images.";
+        mapping = SharedMappedFile(new MappedFile(files.first()));
+    } else {
+        mapping = SharedMappedFile(new MappedFile(path));
+    }
+    if (!mapping->isValid())
+        return "File error: Selected file is not readable.";
+    Fits::Header h;
+    auto error = h.parse(mapping->data(), mapping->size());
+    if (!error.isEmpty())
+        return "File error: " + error;
+    if (!files.isEmpty() && h.planes() != 1 && h.planes() != 3)
+        return "File error: Images must have one or three color planes.";
+    if (mapping->size() < h.dataOffset + h.planeBytes() * h.planes())
+        return "File error: FITS image is truncated.";
+    if (!files.isEmpty())
+        mapping.clear();
+    reader_.reset(new FitsReader(files, h, mapping));
+    inputPath = path;
+    return QString {};
+}
+
+Q_IMPORT_PLUGIN(FitsSource)
@@ -0,0 +1,156 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FITS_H
+#define FITS_H
+
+#define QT_STATICPLUGIN
+
+#include "videosources/interfaces.h"
+#include "videosources/mappedfile.h"
+#include "bufferpool.h"
+#include "fitsformat.h"
+#include <QLineEdit>
+#include <QStringList>
+
+namespace FitsVideo
+{
+
+class FitsReader;
+
+/*
+ * Reads either a directory of FITS images, each being a frame, or a single
+ * FITS file, whose third axis, if any, holds the frames. Files are mapped
+ * into memory and the headers of the images in a directory are only read
+ * when their frame is.
+ */
+class FitsSource: public QObject, public VideoSourcePlugin
+{
+    Q_OBJECT
+    Q_INTERFACES(VideoSourcePlugin)
+    Q_PLUGIN_METADATA(IID "si.ad-vega.arif.FitsSource")
+
+public:
+    explicit FitsSource(QObject* parent = 0);
+    QString name();
+    QString readableName();
+    VideoSourceConfigurationWidget* createConfigurationWidget();
+    SharedRawFrame createRawFrame();
+    SharedDecoder createDecoder();
+    Reader* reader();
+    QString settingsGroup();
+    QString initialize(QString overrideInput = QString{});
+
+    static FitsSource* instance;
+
+private:
+    QScopedPointer<FitsReader> reader_;
+
+    friend class FitsSourceConfigWidget;
+    friend class FitsFrame;
+    friend class FitsReader;
+    friend class FitsDecoder;
+};
+
+class FitsSourceConfigWidget : public VideoSourceConfigurationWidget
+{
+    Q_OBJECT
+
+public:
+    explicit FitsSourceConfigWidget();
+
+private slots:
+    void checkConfig();
+    void getFile();
+    void getDirectory();
+
+private:
+    void saveConfig();
+    void restoreConfig();
+
+    QLineEdit* path;
+};
+
+class FitsFrame: public RawFrame
+{
+public:
+    SharedRawFrame copy();
+    VideoSourcePlugin* plugin();
+    void serialize(QDataStream& s);
+    void load(QDataStream& s);
+
+private:
+    const char* constData() const {
+        return mapped ? mapped : frame.constData();
+    }
+    qint64 dataBytes() const {
+        return header.planeBytes() * header.planes();
+    }
+
+    // The header of this frame alone, planes are colors.
+    Fits::Header header;
+    // Frames point into the mapped file, unless they were loaded.
+    FrameBuffer frame;
+    SharedMappedFile mapping;
+    const char* mapped = nullptr;
+    friend class FitsDecoder;
+    friend class FitsSource;
+    friend class FitsReader;
+};
+
+class FitsDecoder: public Decoder
+{
+public:
+    const cv::Mat decode(RawFrame* in);
+    VideoSourcePlugin* plugin();
+
+private:
+    cv::Mat image, planes[3];
+};
+
+class FitsReader: public Reader
+{
+    Q_OBJECT
+
+public:
+    // Reads the files in a directory, or the frames of the cube if there
+    // are no files.
+    FitsReader(const QStringList& files, const Fits::Header& first,
+               SharedMappedFile cube);
+    bool seek(qint64 frame);
+    bool isSequential();
+    quint64 numberOfFrames();
+    VideoSourcePlugin* plugin();
+
+public slots:
+    void readFrame();
+
+private:
+    QString readFile(FitsFrame* f, const QString& filename);
+
+    QStringList files;
+    Fits::Header first;
+    SharedMappedFile cube;
+    qint64 frames;
+    qint64 position = 0;
+    qint64 advisedUntil = 0;
+};
+
+}
+
+#endif
@@ -20,6 +20,7 @@
 #include "videosources/images.h"
 #include <opencv2/highgui/highgui.hpp>
 #include <QFileDialog>
+#include <QFile>
 #include <QFileInfo>
 #include <QMessageBox>
 #include <QVBoxLayout>
@@ -34,6 +35,7 @@ SharedRawFrame ImageFrame::copy()
     auto F = ImageSource::instance->createRawFrame();
     auto f = static_cast<ImageFrame*>(F.data());
     f->filename = filename;
+    f->contents = contents;
     return F;
 }
 
@@ -57,12 +59,16 @@ void ImageFrame::serialize(QDataStream& s)
 const cv::Mat ImageDecoder::decode(RawFrame* in)
 {
     auto f = static_cast<ImageFrame*>(in);
-    return cv::imread(f->filename.toStdString(),
 #if CV_VERSION_MAJOR > 3
-                      cv::IMREAD_ANYCOLOR | cv::IMREAD_ANYDEPTH);
+    const int flags = cv::IMREAD_ANYCOLOR | cv::IMREAD_ANYDEPTH;
 #else
-                      CV_LOAD_IMAGE_ANYCOLOR | CV_LOAD_IMAGE_ANYDEPTH);
+    const int flags = CV_LOAD_IMAGE_ANYCOLOR | CV_LOAD_IMAGE_ANYDEPTH;
 #endif
+    if (!f->contents.isEmpty()) {
+        cv::Mat buf(1, f->contents.size(), CV_8U, f->contents.data());
+        return cv::imdecode(buf, flags);
+    }
+    return cv::imread(f->filename.toStdString(), flags);
 }
 
 VideoSourcePlugin* ImageDecoder::plugin()
@@ -70,9 +76,18 @@ VideoSourcePlugin* ImageDecoder::plugin()
     return ImageSource::instance;
 }
 
-ImageReader::ImageReader(QStringList files): filenames(files)
+ImageReader::ImageReader(QStringList files, int prefetch): filenames(files)
 {
+    if (prefetch > 0) {
+        using namespace std::placeholders;
+        auto fetch = std::bind(&ImageReader::fetchFrame, this, _1, _2);
+        prefetcher.reset(new FramePrefetcher(fetch, prefetch));
+    }
+}
 
+ImageReader::~ImageReader()
+{
+    prefetcher.reset();
 }
 
 bool ImageReader::isSequential()
@@ -90,9 +105,26 @@ bool ImageReader::seek(qint64 frame)
     if (frame < 0 || frame >= filenames.size())
         return false;
     current = frame;
+    if (prefetcher)
+        prefetcher->seek(frame);
     return true;
 }
 
+SharedRawFrame ImageReader::fetchFrame(qint64 index, QString* error)
+{
+    if (index >= filenames.size())
+        return SharedRawFrame();
+    auto F = SharedRawFrame(new ImageFrame);
+    auto f = static_cast<ImageFrame*>(F.data());
+    f->filename = filenames.at(index);
+    // Reading the file here keeps disk latency out of the workers;
+    // if it fails, the decoder will try again and report the error.
+    QFile file(f->filename);
+    if (file.open(QIODevice::ReadOnly))
+        f->contents = file.readAll();
+    return F;
+}
+
 VideoSourcePlugin* ImageReader::plugin()
 {
     return ImageSource::instance;
@@ -100,14 +132,33 @@ VideoSourcePlugin* ImageReader::plugin()
 
 void ImageReader::readFrame()
 {
-    if (current >= (quint64)(filenames.size())) {
-        emit atEnd();
+    if (prefetcher) {
+        SharedRawFrame F;
+        QString msg;
+        switch (prefetcher->take(&F, &msg)) {
+        case FramePrefetcher::Result::Frame: {
+            current++;
+            qint64 arrival = F->metaData.arrival;
+            F->metaData = makeMetaData();
+            F->metaData.arrival = arrival;
+            deliverFrame(F);
+            break;
+        }
+        case FramePrefetcher::Result::AtEnd:
+            deliverAtEnd();
+            break;
+        case FramePrefetcher::Result::Error:
+            deliverError(msg);
+            break;
+        }
+    } else if (current >= (quint64)(filenames.size())) {
+        deliverAtEnd();
     } else {
         auto F = ImageSource::instance->createRawFrame();
         auto f = static_cast<ImageFrame*>(F.data());
         f->metaData = makeMetaData();
         f->filename = filenames.at(current++);
-        emit frameReady(F);
+        deliverFrame(F);
     }
 }
 
@@ -306,6 +357,7 @@ void ImageConfigWidget::restoreConfig()
 QString ImageSource::initialize(QString overrideInput)
 {
     QStringList files;
+    inputPath.clear();
     bool isFile = "file" == settings.value("type", "file").toString();
     if (isFile) {
         if (!overrideInput.isEmpty()) {
@@ -324,14 +376,16 @@ QString ImageSource::initialize(QString overrideInput)
         }
     } else {
         auto dirname = settings.value("directory").toString();
-        if (QFileInfo(dirname).isDir())
+        if (QFileInfo(dirname).isDir()) {
             files = loadFilesFromDirectory(dirname);
-        else {
+            inputPath = dirname;
+        } else {
             return "Directory error: selected directory is not valid.";
         }
     }
     if ((files.size() > 0) && queryFrameSize(files.first())) {
-        reader_.reset(new ImageReader(files));
+        int prefetch = settings.value("prefetch", FramePrefetcher::defaultDepth).toInt();
+        reader_.reset(new ImageReader(files, prefetch));
         return QString{};
     }
     return "No images to load.";
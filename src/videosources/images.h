@@ -22,6 +22,7 @@
 #define QT_STATICPLUGIN
 
 #include "videosources/interfaces.h"
+#include "videosources/prefetcher.h"
 #include <qarvdecoder.h>
 #include <QLineEdit>
 #include <QRadioButton>
@@ -96,6 +97,7 @@ public:
 
 private:
     QString filename;
+    QByteArray contents; // Encoded file contents, if already read.
     friend class ImageDecoder;
     friend class ImageSource;
     friend class ImageReader;
@@ -113,7 +115,8 @@ class ImageReader: public Reader
     Q_OBJECT
 
 public:
-    ImageReader(QStringList files);
+    ImageReader(QStringList files, int prefetch);
+    ~ImageReader();
     bool seek(qint64 frame);
     bool isSequential();
     quint64 numberOfFrames();
@@ -123,8 +126,12 @@ public slots:
     void readFrame();
 
 private:
+    SharedRawFrame fetchFrame(qint64 index, QString* error); // prefetch thread
+
     QStringList filenames;
     quint64 current = 0;
+    // Reads image files ahead of time when enabled.
+    QScopedPointer<FramePrefetcher> prefetcher;
     friend class ImageSource;
 };
 
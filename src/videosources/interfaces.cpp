@@ -18,6 +18,13 @@
 
 #include "videosources/interfaces.h"
 #include <QSettings>
+#include <chrono>
+
+qint64 monotonicTime()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
 
 void FrameMetaData::serialize(QDataStream& s)
 {
@@ -43,7 +50,11 @@ void RawFrame::load(QDataStream& s)
 
 FrameMetaData Reader::makeMetaData()
 {
-    auto now = QDateTime::currentDateTimeUtc();
+    return makeMetaData(QDateTime::currentDateTimeUtc());
+}
+
+FrameMetaData Reader::makeMetaData(const QDateTime& now)
+{
     auto unixtime = now.toTime_t();
     if (unixtime != previousUnixtime) {
         previousUnixtime = unixtime;
@@ -52,9 +63,76 @@ FrameMetaData Reader::makeMetaData()
     FrameMetaData metadata;
     metadata.timestamp = now;
     metadata.frameOfSecond = ++frameOfSecond;
+    metadata.arrival = monotonicTime();
     return metadata;
 }
 
+void Reader::deliverFrame(SharedRawFrame frame)
+{
+    if (batching) {
+        batch << frame;
+    } else {
+        emit frameReady(frame);
+        emit framesReady(QVector<SharedRawFrame>{frame});
+    }
+}
+
+void Reader::deliverFrames(QVector<SharedRawFrame> frames)
+{
+    if (batching) {
+        batch << frames;
+    } else if (!frames.isEmpty()) {
+        for (auto& frame: frames)
+            emit frameReady(frame);
+        emit framesReady(frames);
+    }
+}
+
+void Reader::deliverError(QString msg)
+{
+    if (batching) {
+        batchError = true;
+        batchErrorMessage = msg;
+    } else {
+        emit error(msg);
+    }
+}
+
+void Reader::deliverAtEnd()
+{
+    if (batching)
+        batchAtEnd = true;
+    else
+        emit atEnd();
+}
+
+void Reader::readFrames(int count)
+{
+    batching = true;
+    for (int i = 0; i < count && !batchAtEnd && !batchError; i++) {
+        int previous = batch.size();
+        readFrame();
+        // Live sources and sources waiting for data don't deliver now.
+        if (batch.size() == previous)
+            break;
+    }
+    batching = false;
+
+    // Reset the state first, slots may call readFrames() again.
+    QVector<SharedRawFrame> frames;
+    frames.swap(batch);
+    bool atEnd_ = batchAtEnd, error_ = batchError;
+    QString msg = batchErrorMessage;
+    batchAtEnd = batchError = false;
+    batchErrorMessage.clear();
+
+    deliverFrames(frames);
+    if (error_)
+        emit error(msg);
+    else if (atEnd_)
+        emit atEnd();
+}
+
 void VideoSourcePlugin::readSettings(QString file)
 {
     QScopedPointer<QSettings> config;
@@ -83,6 +161,7 @@ void VideoSourcePlugin::saveSettings(QString file)
 static int registerTypes()
 {
     qRegisterMetaType<SharedRawFrame>("SharedRawFrame");
+    qRegisterMetaType<QVector<SharedRawFrame>>("QVector<SharedRawFrame>");
     return 0;
 }
 
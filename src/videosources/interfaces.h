@@ -27,6 +27,7 @@
 #include <QGroupBox>
 #include <QMap>
 #include <QVariant>
+#include <QVector>
 #include <opencv2/core/core.hpp>
 
 class VideoSourcePlugin;
@@ -35,6 +36,10 @@ class Decoder;
 typedef QSharedPointer<RawFrame> SharedRawFrame;
 typedef QSharedPointer<Decoder> SharedDecoder;
 
+// Nanoseconds of a monotonic clock with an arbitrary origin, for
+// measuring how long frames take to process.
+qint64 monotonicTime();
+
 struct FrameMetaData
 {
     void serialize(QDataStream& s);
@@ -42,6 +47,9 @@ struct FrameMetaData
 
     QDateTime timestamp;
     unsigned int frameOfSecond = 0;
+    // When the reader got the frame, see monotonicTime(). It is only
+    // meaningful within the process, so it is not serialized.
+    qint64 arrival = 0;
 };
 
 class RawFrame
@@ -77,25 +85,49 @@ public:
     virtual VideoSourcePlugin* plugin() = 0;
 
 protected:
+    // Uses the current time, or the given one for recorded timestamps.
     FrameMetaData makeMetaData();
+    FrameMetaData makeMetaData(const QDateTime& timestamp);
+
+    // Readers report frames, errors and the end of the video through
+    // these instead of emitting signals directly, so that frames read
+    // by readFrames() are emitted as a batch.
+    void deliverFrame(SharedRawFrame frame);
+    void deliverFrames(QVector<SharedRawFrame> frames);
+    void deliverError(QString msg);
+    void deliverAtEnd();
 
 public slots:
     // Used by non-live sources to throttle reading.
-    // None-live sources should emit frameReady()
+    // None-live sources should deliver the frame
     // _immediately_, in th main thread; foreman is
     // ready _now_ and may be busy later.
-    // Live sources ignore this and emit frameReady()
-    // for every frame.
+    // Live sources ignore this and deliver every
+    // frame.
     virtual void readFrame() = 0;
 
+    // Reads up to count frames like readFrame() does and emits them
+    // together. If reading stops early, atEnd() or error() is emitted
+    // after the frames.
+    virtual void readFrames(int count);
+
 signals:
     void error(QString msg);
     void atEnd();
+    // Emitted for every frame.
     void frameReady(SharedRawFrame frame);
+    // Emitted for every batch of frames, after frameReady() was emitted
+    // for each of them. Consumers should connect to one or the other.
+    void framesReady(QVector<SharedRawFrame> frames);
 
 private:
     uint previousUnixtime = 0;
     uint frameOfSecond = 0;
+    // State of readFrames().
+    bool batching = false;
+    QVector<SharedRawFrame> batch;
+    bool batchAtEnd = false, batchError = false;
+    QString batchErrorMessage;
 };
 
 class VideoSourceConfigurationWidget : public QGroupBox
@@ -146,6 +178,11 @@ public:
     // The optional argument allows the caller to specify where the
     // video is to be read from, regardless of the settings.
     virtual QString initialize(QString overrideInput = QString{}) = 0;
+
+    // The file or directory a recorded video is read from, set by
+    // initialize(). It is empty for cameras and other live sources.
+    // Results of processing the video can be kept next to it.
+    QString inputPath;
 };
 
 Q_DECLARE_INTERFACE(VideoSourcePlugin,
@@ -0,0 +1,470 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "videosources/libavvideo.h"
+#include <QFormLayout>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileDialog>
+#include <QPushButton>
+#include <QMessageBox>
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+using namespace LibavVideo;
+
+LibavSource* LibavSource::instance;
+
+static QString errorString(int error)
+{
+    char buf[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_strerror(error, buf, sizeof(buf));
+    return QString::fromLocal8Bit(buf);
+}
+
+LibavSource::LibavSource(QObject* parent): QObject(parent)
+{
+    instance = this;
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+    av_register_all();
+#endif
+}
+
+AVFrame* LibavSource::acquireFrame()
+{
+    QMutexLocker lock(&poolMutex);
+    if (framePool.isEmpty())
+        return av_frame_alloc();
+    return framePool.takeLast();
+}
+
+void LibavSource::releaseFrame(AVFrame* frame)
+{
+    av_frame_unref(frame);
+    QMutexLocker lock(&poolMutex);
+    framePool.append(frame);
+}
+
+LibavFrame::LibavFrame()
+{
+    frame = LibavSource::instance->acquireFrame();
+}
+
+LibavFrame::~LibavFrame()
+{
+    LibavSource::instance->releaseFrame(frame);
+}
+
+SharedRawFrame LibavFrame::copy()
+{
+    auto f = new LibavFrame;
+    // Only the reference is copied, the data is shared and read-only.
+    av_frame_ref(f->frame, frame);
+    f->metaData = metaData;
+    return SharedRawFrame(f);
+}
+
+VideoSourcePlugin* LibavFrame::plugin()
+{
+    return LibavSource::instance;
+}
+
+void LibavFrame::serialize(QDataStream& s)
+{
+    auto fmt = static_cast<AVPixelFormat>(frame->format);
+    int bytes = av_image_get_buffer_size(fmt, frame->width, frame->height, 1);
+    QByteArray data(qMax(bytes, 0), 0);
+    if (bytes > 0)
+        av_image_copy_to_buffer(reinterpret_cast<uint8_t*>(data.data()), bytes,
+                                frame->data, frame->linesize, fmt,
+                                frame->width, frame->height, 1);
+    s << qint32(frame->format) << qint32(frame->width)
+      << qint32(frame->height) << data;
+    RawFrame::serialize(s);
+}
+
+void LibavFrame::load(QDataStream& s)
+{
+    qint32 format, width, height;
+    QByteArray data;
+    s >> format >> width >> height >> data;
+    av_frame_unref(frame);
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    auto fmt = static_cast<AVPixelFormat>(format);
+    if (!data.isEmpty() && av_frame_get_buffer(frame, 32) == 0) {
+        uint8_t* planes[4];
+        int linesizes[4];
+        av_image_fill_arrays(planes, linesizes,
+                             reinterpret_cast<const uint8_t*>(data.constData()),
+                             fmt, width, height, 1);
+        av_image_copy(frame->data, frame->linesize,
+                      const_cast<const uint8_t**>(planes), linesizes,
+                      fmt, width, height);
+    }
+    RawFrame::load(s);
+}
+
+// Returns the OpenCV depth of the first plane if it holds nothing but
+// brightness samples in native byte order, and -1 otherwise.
+static int lumaPlaneDepth(const AVPixFmtDescriptor* desc)
+{
+    uint64_t unsupported = AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL |
+                           AV_PIX_FMT_FLAG_BAYER | AV_PIX_FMT_FLAG_HWACCEL |
+                           AV_PIX_FMT_FLAG_BITSTREAM;
+#ifdef AV_PIX_FMT_FLAG_FLOAT
+    unsupported |= AV_PIX_FMT_FLAG_FLOAT;
+#endif
+    if (!desc || desc->flags & unsupported)
+        return -1;
+    auto& luma = desc->comp[0];
+    int bytes = (luma.depth + luma.shift + 7) / 8;
+    if (luma.plane != 0 || luma.step != bytes || bytes > 2)
+        return -1;
+    for (int i = 1; i < desc->nb_components; i++)
+        if (desc->comp[i].plane == 0)
+            return -1;
+    bool bigEndian = desc->flags & AV_PIX_FMT_FLAG_BE;
+    if (bytes == 2 && bigEndian != (Q_BYTE_ORDER == Q_BIG_ENDIAN))
+        return -1;
+    return bytes == 1 ? CV_8U : CV_16U;
+}
+
+LibavDecoder::~LibavDecoder()
+{
+    sws_freeContext(sws);
+}
+
+const cv::Mat LibavDecoder::decode(RawFrame* in)
+{
+    auto frame = static_cast<LibavFrame*>(in)->frame;
+    auto fmt = static_cast<AVPixelFormat>(frame->format);
+    auto desc = av_pix_fmt_desc_get(fmt);
+    int depth = lumaPlaneDepth(desc);
+    bool gray = desc && desc->nb_components <= 2;
+    if (depth >= 0 && (gray || LibavSource::instance->lumaOnly)) {
+        // The image refers to the frame's data and has no allocator, so
+        // processing makes a copy before it modifies it.
+        return cv::Mat(frame->height, frame->width, CV_MAKETYPE(depth, 1),
+                       frame->data[0], frame->linesize[0]);
+    }
+
+    sws = sws_getCachedContext(sws, frame->width, frame->height, fmt,
+                               frame->width, frame->height, AV_PIX_FMT_BGR24,
+                               SWS_FAST_BILINEAR | SWS_BITEXACT,
+                               nullptr, nullptr, nullptr);
+    if (!sws)
+        return cv::Mat();
+    converted.create(frame->height, frame->width, CV_8UC3);
+    uint8_t* dst[] = { converted.data };
+    int dstStride[] = { static_cast<int>(converted.step[0]) };
+    sws_scale(sws, frame->data, frame->linesize, 0, frame->height,
+              dst, dstStride);
+    return converted;
+}
+
+VideoSourcePlugin* LibavDecoder::plugin()
+{
+    return LibavSource::instance;
+}
+
+LibavReader::LibavReader(): seekTarget(AV_NOPTS_VALUE) {}
+
+LibavReader::~LibavReader()
+{
+    av_packet_free(&packet);
+    avcodec_free_context(&codec);
+    avformat_close_input(&format);
+}
+
+QString LibavReader::open(QString filename, int threads)
+{
+    auto name = QFile::encodeName(filename);
+    int err = avformat_open_input(&format, name.constData(), nullptr, nullptr);
+    if (err < 0)
+        return "File error: " + errorString(err);
+    err = avformat_find_stream_info(format, nullptr);
+    if (err < 0)
+        return "File error: " + errorString(err);
+#if LIBAVFORMAT_VERSION_MAJOR >= 59
+    const AVCodec* decoder = nullptr;
+#else
+    AVCodec* decoder = nullptr;
+#endif
+    int index = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1,
+                                    &decoder, 0);
+    if (index < 0 || !decoder)
+        return "File error: No decodable video stream found.";
+    stream = format->streams[index];
+    for (unsigned int i = 0; i < format->nb_streams; i++)
+        if (int(i) != index)
+            format->streams[i]->discard = AVDISCARD_ALL;
+
+    codec = avcodec_alloc_context3(decoder);
+    packet = av_packet_alloc();
+    if (!codec || !packet)
+        return "Decoder error: Out of memory.";
+    avcodec_parameters_to_context(codec, stream->codecpar);
+    // Zero lets libavcodec pick the number of threads.
+    codec->thread_count = threads;
+    codec->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    err = avcodec_open2(codec, decoder, nullptr);
+    if (err < 0)
+        return "Decoder error: " + errorString(err);
+    return QString {};
+}
+
+static AVRational frameRate(AVStream* stream)
+{
+    if (stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0)
+        return stream->avg_frame_rate;
+    if (stream->r_frame_rate.num > 0 && stream->r_frame_rate.den > 0)
+        return stream->r_frame_rate;
+    return AVRational {25, 1};
+}
+
+bool LibavReader::seek(qint64 frame)
+{
+    if (isSequential() || frame < 0)
+        return false;
+    qint64 start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    qint64 target = start + av_rescale_q(frame, av_inv_q(frameRate(stream)),
+                                         stream->time_base);
+    // Land on the preceding keyframe from the container's index and decode
+    // up to the target from there.
+    if (av_seek_frame(format, stream->index, target, AVSEEK_FLAG_BACKWARD) < 0)
+        return false;
+    avcodec_flush_buffers(codec);
+    draining = false;
+    seekTarget = frame > 0 ? target : AV_NOPTS_VALUE;
+    return true;
+}
+
+bool LibavReader::isSequential()
+{
+    return !format->pb || !(format->pb->seekable & AVIO_SEEKABLE_NORMAL);
+}
+
+quint64 LibavReader::numberOfFrames()
+{
+    if (stream->nb_frames > 0)
+        return stream->nb_frames;
+    auto rate = frameRate(stream);
+    if (stream->duration != AV_NOPTS_VALUE)
+        return av_rescale_q(stream->duration, stream->time_base, av_inv_q(rate));
+    if (format->duration != AV_NOPTS_VALUE)
+        return av_rescale_q(format->duration, AV_TIME_BASE_Q, av_inv_q(rate));
+    return 0;
+}
+
+VideoSourcePlugin* LibavReader::plugin()
+{
+    return LibavSource::instance;
+}
+
+// Returns false at the end of the video or on error, which sets the message.
+bool LibavReader::decodeFrame(AVFrame* frame, QString* error)
+{
+    forever {
+        int err = avcodec_receive_frame(codec, frame);
+        if (err == 0) {
+            qint64 pts = frame->best_effort_timestamp;
+            if (seekTarget != AV_NOPTS_VALUE && pts != AV_NOPTS_VALUE &&
+                pts < seekTarget) {
+                av_frame_unref(frame);
+                continue;
+            }
+            seekTarget = AV_NOPTS_VALUE;
+            return true;
+        } else if (err == AVERROR_EOF) {
+            return false;
+        } else if (err != AVERROR(EAGAIN)) {
+            *error = "Decoder error: " + errorString(err);
+            return false;
+        }
+
+        // The decoder needs more input.
+        if (draining)
+            return false;
+        err = av_read_frame(format, packet);
+        if (err == AVERROR_EOF) {
+            // Get the frames the decoder is still holding.
+            draining = true;
+            avcodec_send_packet(codec, nullptr);
+            continue;
+        } else if (err < 0) {
+            *error = "File error: " + errorString(err);
+            return false;
+        }
+        if (packet->stream_index == stream->index)
+            err = avcodec_send_packet(codec, packet);
+        av_packet_unref(packet);
+        if (err < 0 && err != AVERROR(EAGAIN) && err != AVERROR_INVALIDDATA) {
+            *error = "Decoder error: " + errorString(err);
+            return false;
+        }
+    }
+}
+
+void LibavReader::readFrame()
+{
+    auto f = new LibavFrame;
+    SharedRawFrame frame(f);
+    QString error;
+    if (decodeFrame(f->frame, &error)) {
+        f->metaData = makeMetaData();
+        deliverFrame(frame);
+    } else if (!error.isNull()) {
+        deliverError(error);
+    } else {
+        deliverAtEnd();
+    }
+}
+
+LibavSourceConfigWidget::LibavSourceConfigWidget() :
+    VideoSourceConfigurationWidget("Compressed video configuration")
+{
+    auto layout = new QFormLayout(this);
+    auto fileInputRow = new QHBoxLayout();
+    fileName = new QLineEdit();
+    auto openFileDialog = new QPushButton("Open");
+    auto icon = QIcon::fromTheme("document-open");
+    if (!icon.isNull()) {
+        openFileDialog->setText("");
+        openFileDialog->setIcon(icon);
+    }
+    fileInputRow->addWidget(fileName);
+    fileInputRow->addWidget(openFileDialog);
+    layout->addRow("Input file:", fileInputRow);
+    this->connect(openFileDialog, SIGNAL(clicked(bool)), SLOT(getFile()));
+
+    threads = new QSpinBox;
+    threads->setRange(0, 64);
+    threads->setSpecialValueText("Automatic");
+    layout->addRow("Decoding threads:", threads);
+
+    lumaCheckBox = new QCheckBox("Use only brightness of color videos");
+    lumaCheckBox->setToolTip("Skips color conversion of YUV videos.");
+    layout->addRow(lumaCheckBox);
+
+    auto finishButton = new QPushButton("Finish");
+    layout->addRow(finishButton);
+    this->connect(finishButton, SIGNAL(clicked(bool)), SLOT(checkConfig()));
+    restoreConfig();
+}
+
+void LibavSourceConfigWidget::checkConfig()
+{
+    LibavSource* s = LibavSource::instance;
+    saveConfig();
+    auto result = s->initialize();
+    if (result.isNull()) {
+        s->saveSettings();
+        emit configurationComplete();
+    } else {
+        QMessageBox tmp;
+        tmp.setWindowTitle("Error");
+        tmp.setText(result);
+        tmp.exec();
+    }
+}
+
+void LibavSourceConfigWidget::getFile()
+{
+    auto tmp = QFileDialog::getOpenFileName(this,
+                                            "Open video file",
+                                            fileName->text(),
+                                            "Videos (*.avi *.mkv *.mp4 *.mov *.webm);;"
+                                            "All files (*)");
+    if (!tmp.isNull())
+        fileName->setText(tmp);
+}
+
+void LibavSourceConfigWidget::saveConfig()
+{
+    auto s = LibavSource::instance;
+    s->settings.insert("file", fileName->text());
+    s->settings.insert("threads", threads->value());
+    s->settings.insert("luma", lumaCheckBox->isChecked());
+}
+
+void LibavSourceConfigWidget::restoreConfig()
+{
+    auto s = LibavSource::instance;
+    s->readSettings();
+    fileName->setText(s->settings.value("file").toString());
+    threads->setValue(s->settings.value("threads", 0).toInt());
+    lumaCheckBox->setChecked(s->settings.value("luma", false).toBool());
+}
+
+QString LibavSource::name()
+{
+    return "Libav";
+}
+
+QString LibavSource::readableName()
+{
+    return "Compressed video file (AVI, MKV, MP4, ...)";
+}
+
+VideoSourceConfigurationWidget* LibavSource::createConfigurationWidget()
+{
+    return new LibavSourceConfigWidget;
+}
+
+SharedDecoder LibavSource::createDecoder()
+{
+    return SharedDecoder(new LibavDecoder);
+}
+
+SharedRawFrame LibavSource::createRawFrame()
+{
+    return SharedRawFrame(new LibavFrame);
+}
+
+Reader* LibavSource::reader()
+{
+    return reader_.data();
+}
+
+QString LibavSource::settingsGroup()
+{
+    return "format_" + LibavSource::instance->name();
+}
+
+QString LibavSource::initialize(QString overrideInput)
+{
+    auto file = overrideInput.isNull() ? settings.value("file").toString() : overrideInput;
+    QScopedPointer<LibavReader> r(new LibavReader);
+    auto error = r->open(file, settings.value("threads", 0).toInt());
+    if (!error.isEmpty())
+        return error;
+    lumaOnly = settings.value("luma", false).toBool();
+    reader_.reset(r.take());
+    // Streams can't be recognized when read again.
+    inputPath = QFileInfo(file).isFile() ? file : QString{};
+    return QString {};
+}
+
+Q_IMPORT_PLUGIN(LibavSource)
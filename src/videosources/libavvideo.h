@@ -0,0 +1,163 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBAVVIDEO_H
+#define LIBAVVIDEO_H
+
+#define QT_STATICPLUGIN
+
+#include "videosources/interfaces.h"
+#include <QLineEdit>
+#include <QSpinBox>
+#include <QCheckBox>
+#include <QMutex>
+#include <QVector>
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+namespace LibavVideo
+{
+
+class LibavReader;
+
+/*
+ * Reads compressed videos (AVI, MKV, MP4 etc.) with libavformat. Frames
+ * are decoded by the reader, using libavcodec's frame and slice threading,
+ * and passed on as decoded AVFrames. The processing threads then only map
+ * the frame to a cv::Mat, which needs no conversion for gray images and
+ * for the brightness plane of planar YUV images.
+ */
+class LibavSource: public QObject, public VideoSourcePlugin
+{
+    Q_OBJECT
+    Q_INTERFACES(VideoSourcePlugin)
+    Q_PLUGIN_METADATA(IID "si.ad-vega.arif.LibavSource")
+
+public:
+    explicit LibavSource(QObject* parent = 0);
+    QString name();
+    QString readableName();
+    VideoSourceConfigurationWidget* createConfigurationWidget();
+    SharedRawFrame createRawFrame();
+    SharedDecoder createDecoder();
+    Reader* reader();
+    QString settingsGroup();
+    QString initialize(QString overrideInput = QString{});
+
+    static LibavSource* instance;
+
+private:
+    // AVFrames are recycled, frames are released by the workers.
+    AVFrame* acquireFrame();
+    void releaseFrame(AVFrame* frame);
+
+    QScopedPointer<LibavReader> reader_;
+    bool lumaOnly = false;
+    QMutex poolMutex;
+    QVector<AVFrame*> framePool;
+
+    friend class LibavSourceConfigWidget;
+    friend class LibavFrame;
+    friend class LibavReader;
+    friend class LibavDecoder;
+};
+
+class LibavSourceConfigWidget : public VideoSourceConfigurationWidget
+{
+    Q_OBJECT
+
+public:
+    explicit LibavSourceConfigWidget();
+
+private slots:
+    void checkConfig();
+    void getFile();
+
+private:
+    void saveConfig();
+    void restoreConfig();
+
+    QLineEdit* fileName;
+    QSpinBox* threads;
+    QCheckBox* lumaCheckBox;
+};
+
+class LibavFrame: public RawFrame
+{
+public:
+    LibavFrame();
+    ~LibavFrame();
+    SharedRawFrame copy();
+    VideoSourcePlugin* plugin();
+    void serialize(QDataStream& s);
+    void load(QDataStream& s);
+
+private:
+    AVFrame* frame;
+    friend class LibavDecoder;
+    friend class LibavSource;
+    friend class LibavReader;
+};
+
+class LibavDecoder: public Decoder
+{
+public:
+    ~LibavDecoder();
+    const cv::Mat decode(RawFrame* in);
+    VideoSourcePlugin* plugin();
+
+private:
+    SwsContext* sws = nullptr;
+    cv::Mat converted;
+};
+
+class LibavReader: public Reader
+{
+    Q_OBJECT
+
+public:
+    LibavReader();
+    ~LibavReader();
+    QString open(QString filename, int threads);
+    bool seek(qint64 frame);
+    bool isSequential();
+    quint64 numberOfFrames();
+    VideoSourcePlugin* plugin();
+
+public slots:
+    void readFrame();
+
+private:
+    bool decodeFrame(AVFrame* frame, QString* error);
+
+    AVFormatContext* format = nullptr;
+    AVCodecContext* codec = nullptr;
+    AVStream* stream = nullptr;
+    AVPacket* packet = nullptr;
+    bool draining = false;
+    qint64 seekTarget; // Frames before this timestamp are skipped.
+};
+
+}
+
+#endif
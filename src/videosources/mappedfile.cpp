@@ -0,0 +1,68 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "videosources/mappedfile.h"
+#include <QFile>
+#include <algorithm>
+#include <cstdint>
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+}
+
+MappedFile::MappedFile(const QString& filename)
+{
+    int fd = open(QFile::encodeName(filename).constData(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (quint64)st.st_size <= SIZE_MAX) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            ptr = static_cast<const char*>(p);
+            length = st.st_size;
+        }
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (ptr)
+        munmap(const_cast<char*>(ptr), length);
+}
+
+void MappedFile::adviseSequential()
+{
+    if (ptr)
+        madvise(const_cast<char*>(ptr), length, MADV_SEQUENTIAL);
+}
+
+void MappedFile::adviseWillNeed(qint64 offset, qint64 bytes)
+{
+    if (!ptr || offset >= length || bytes <= 0)
+        return;
+    static const qint64 page = sysconf(_SC_PAGESIZE);
+    qint64 start = offset / page * page;
+    qint64 end = std::min(offset + bytes, length);
+    madvise(const_cast<char*>(ptr) + start, end - start, MADV_WILLNEED);
+}
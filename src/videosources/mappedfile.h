@@ -0,0 +1,52 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VIDEOSOURCES_MAPPEDFILE_H
+#define VIDEOSOURCES_MAPPEDFILE_H
+
+#include <QString>
+#include <QSharedPointer>
+
+/*
+ * A read-only mapping of a whole file. Frames that point into the
+ * mapping hold a SharedMappedFile so that it outlives them.
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const QString& filename);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isValid() const { return ptr != nullptr; }
+    const char* data() const { return ptr; }
+    qint64 size() const { return length; }
+
+    // Access pattern hints for the kernel's read-ahead.
+    void adviseSequential();
+    void adviseWillNeed(qint64 offset, qint64 bytes);
+
+private:
+    const char* ptr = nullptr;
+    qint64 length = 0;
+};
+
+typedef QSharedPointer<MappedFile> SharedMappedFile;
+
+#endif
@@ -0,0 +1,123 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "videosources/prefetcher.h"
+#include "affinity.h"
+#include <cmath>
+
+static const int minimumDepth = 2;
+static const double averagingWeight = 0.1;
+// Pauses longer than this (e.g. a stopped foreman) don't count as a rate.
+static const qint64 maxTakeInterval = 1000000000;
+
+FramePrefetcher::FramePrefetcher(FetchFunction fetch_, int maxDepth_,
+                                 qint64 firstIndex):
+    fetch(fetch_), nextIndex(firstIndex),
+    maxDepth(qMax(maxDepth_, minimumDepth)), depth(minimumDepth)
+{
+    clock.start();
+    start();
+}
+
+FramePrefetcher::~FramePrefetcher()
+{
+    mutex.lock();
+    quit = true;
+    spaceFreed.wakeAll();
+    mutex.unlock();
+    wait();
+}
+
+FramePrefetcher::Result
+FramePrefetcher::take(SharedRawFrame* frame, QString* error)
+{
+    QMutexLocker lock(&mutex);
+    qint64 now = clock.nsecsElapsed();
+    if (lastTake >= 0) {
+        qint64 interval = qMin(now - lastTake, maxTakeInterval);
+        takeInterval += averagingWeight * (interval - takeInterval);
+    }
+    lastTake = now;
+    if (takeInterval > 0) {
+        // Keep enough frames to cover twice the frames taken while one
+        // is being read, so that reading hiccups are absorbed.
+        int wanted = std::ceil(2 * fetchTime / takeInterval) + 1;
+        depth = qBound(minimumDepth, wanted, maxDepth);
+    }
+
+    while (ring.isEmpty()) {
+        if (finished)
+            return Result::AtEnd;
+        spaceFreed.wakeAll();
+        frameAdded.wait(&mutex);
+    }
+    auto item = ring.dequeue();
+    spaceFreed.wakeAll();
+    if (item.frame) {
+        *frame = item.frame;
+        return Result::Frame;
+    } else if (!item.error.isNull()) {
+        *error = item.error;
+        return Result::Error;
+    } else {
+        return Result::AtEnd;
+    }
+}
+
+void FramePrefetcher::seek(qint64 index)
+{
+    QMutexLocker lock(&mutex);
+    generation++;
+    ring.clear();
+    nextIndex = index;
+    finished = false;
+    spaceFreed.wakeAll();
+}
+
+void FramePrefetcher::run()
+{
+    pinCurrentThread(ThreadRole::Reader);
+    QMutexLocker lock(&mutex);
+    while (!quit) {
+        if (finished || ring.size() >= depth) {
+            spaceFreed.wait(&mutex);
+            continue;
+        }
+        qint64 index = nextIndex++;
+        uint fetchGeneration = generation;
+        lock.unlock();
+
+        Item item;
+        qint64 start = clock.nsecsElapsed();
+        item.frame = fetch(index, &item.error);
+        qint64 elapsed = clock.nsecsElapsed() - start;
+        // The frame arrived now, the reader only fills in the rest of
+        // the metadata once it is taken.
+        if (item.frame)
+            item.frame->metaData.arrival = monotonicTime();
+
+        lock.relock();
+        fetchTime += averagingWeight * (elapsed - fetchTime);
+        if (fetchGeneration != generation)
+            continue;
+        if (!item.frame)
+            finished = true;
+        ring.enqueue(item);
+        frameAdded.wakeAll();
+    }
+}
@@ -0,0 +1,89 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VIDEOSOURCES_PREFETCHER_H
+#define VIDEOSOURCES_PREFETCHER_H
+
+#include "videosources/interfaces.h"
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QElapsedTimer>
+#include <functional>
+
+/*
+ * Reads frames of a file-based source in a background thread and keeps
+ * them in a ring, so that Reader::readFrame() can hand one out without
+ * waiting for the disk. The number of frames kept ahead adapts to how
+ * fast they are taken compared to how long it takes to read one, up to
+ * the configured maximum.
+ */
+class FramePrefetcher: public QThread
+{
+    Q_OBJECT
+
+public:
+    // Reads the frame with the given index. It is only ever called from
+    // the prefetching thread. It returns a null frame at the end of the
+    // video, and additionally sets the error message if reading failed.
+    typedef std::function<SharedRawFrame(qint64 index, QString* error)>
+        FetchFunction;
+
+    enum class Result {
+        Frame,
+        AtEnd,
+        Error
+    };
+
+    FramePrefetcher(FetchFunction fetch, int maxDepth, qint64 firstIndex = 0);
+    ~FramePrefetcher();
+
+    // Blocks until the next frame has been read.
+    Result take(SharedRawFrame* frame, QString* error);
+
+    // Discards frames read so far and continues from the given index.
+    void seek(qint64 index);
+
+    static const int defaultDepth = 16;
+
+protected:
+    void run();
+
+private:
+    struct Item {
+        SharedRawFrame frame;
+        QString error;
+    };
+
+    FetchFunction fetch;
+    QMutex mutex;
+    QWaitCondition frameAdded, spaceFreed;
+    QQueue<Item> ring;
+    qint64 nextIndex = 0;
+    uint generation = 0; // Changed by seek() to invalidate a running fetch.
+    bool finished = false; // End of video or error has been queued.
+    bool quit = false;
+    int maxDepth, depth;
+    // Exponential moving averages in nanoseconds.
+    QElapsedTimer clock;
+    qint64 lastTake = -1;
+    double takeInterval = 0, fetchTime = 0;
+};
+
+#endif
@@ -41,17 +41,11 @@ QArvVideoSource::QArvVideoSource(QObject* parent): QObject(parent)
     instance = this;
 }
 
-QArvVideoFrame::~QArvVideoFrame()
-{
-    QArvVideoSource::instance->frameDestroyed(frame);
-}
-
 SharedRawFrame QArvVideoFrame::copy()
 {
-    SharedRawFrame f = QArvVideoSource::instance->createRawFrame();
-    QArvVideoFrame* r = static_cast<QArvVideoFrame*>(f.data());
+    auto r = new QArvVideoFrame;
     *r = *this;
-    return f;
+    return SharedRawFrame(r);
 }
 
 VideoSourcePlugin* QArvVideoFrame::plugin()
@@ -92,11 +86,18 @@ const cv::Mat QArvVideoDecoder::decode(RawFrame* in)
     return thedecoder->getCvImage();
 }
 
-QArvVideoReader::QArvVideoReader(QString filename):
-    qarvVideo(filename)
+QArvVideoReader::QArvVideoReader(QString filename, int prefetch):
+    qarvVideo(filename), prefetchDepth(prefetch)
 {
     if (qarvVideo.status() == false)
-        emit error("Could not read video description file.");
+        deliverError("Could not read video description file.");
+    seekable = qarvVideo.isSeekable();
+    frameCount = seekable ? qarvVideo.numberOfFrames() : 0;
+}
+
+QArvVideoReader::~QArvVideoReader()
+{
+    prefetcher.reset();
 }
 
 VideoSourcePlugin* QArvVideoReader::plugin()
@@ -106,41 +107,96 @@ VideoSourcePlugin* QArvVideoReader::plugin()
 
 bool QArvVideoReader::isSequential()
 {
-    return !qarvVideo.isSeekable();
+    return !seekable;
 }
 
 quint64 QArvVideoReader::numberOfFrames()
 {
-    if (isSequential())
-        return 0;
-    return qarvVideo.numberOfFrames();
+    return frameCount;
 }
 
 bool QArvVideoReader::seek(qint64 frame)
 {
     if (isSequential())
         return false;
-    return qarvVideo.seek(frame);
+    if (prefetcher) {
+        if (frame < 0 || frame > (qint64)numberOfFrames())
+            return false;
+        prefetcher->seek(frame);
+        return true;
+    }
+    if (!qarvVideo.seek(frame))
+        return false;
+    prefetchPosition = frame;
+    return true;
 }
 
-void QArvVideoReader::readFrame()
+SharedRawFrame QArvVideoReader::fetchFrame(qint64 index, QString* error)
 {
-    QArvVideoSource* s = QArvVideoSource::instance;
-    SharedRawFrame frm = s->createRawFrame();
-    QArvVideoFrame* f = static_cast<QArvVideoFrame*>(frm.data());
-    f->frame = qarvVideo.read();
-    if (f->frame.isNull()) {
+    if (index != prefetchPosition) {
+        if (!qarvVideo.seek(index)) {
+            *error = "Could not seek in video.";
+            return SharedRawFrame();
+        }
+        prefetchPosition = index;
+    }
+    auto data = qarvVideo.read();
+    if (data.isNull()) {
         if (qarvVideo.atEnd()) {
-            emit atEnd();
+            return SharedRawFrame();
         } else if (qarvVideo.error() == QFile::NoError &&
                    qarvVideo.status() == false) {
-            emit error("Could not read video description file.");
+            *error = "Could not read video description file.";
         } else {
-            emit error(qarvVideo.errorString());
+            *error = qarvVideo.errorString();
         }
+        return SharedRawFrame();
+    }
+    prefetchPosition++;
+    auto f = new QArvVideoFrame;
+    f->frame = data;
+    return SharedRawFrame(f);
+}
+
+void QArvVideoReader::readFrame()
+{
+    if (!prefetcher && prefetchDepth > 0) {
+        // Started lazily so that the initial seek happens without it.
+        using namespace std::placeholders;
+        auto fetch = std::bind(&QArvVideoReader::fetchFrame, this, _1, _2);
+        prefetcher.reset(new FramePrefetcher(fetch, prefetchDepth,
+                                             prefetchPosition));
+    }
+    SharedRawFrame frm;
+    QString msg;
+    FramePrefetcher::Result result;
+    if (prefetcher) {
+        result = prefetcher->take(&frm, &msg);
     } else {
+        frm = fetchFrame(prefetchPosition, &msg);
+        if (frm)
+            result = FramePrefetcher::Result::Frame;
+        else if (msg.isNull())
+            result = FramePrefetcher::Result::AtEnd;
+        else
+            result = FramePrefetcher::Result::Error;
+    }
+    switch (result) {
+    case FramePrefetcher::Result::Frame: {
+        // Only prefetched frames are stamped when read.
+        qint64 arrival = frm->metaData.arrival;
         frm->metaData = makeMetaData();
-        emit frameReady(frm);
+        if (arrival > 0)
+            frm->metaData.arrival = arrival;
+        deliverFrame(frm);
+        break;
+    }
+    case FramePrefetcher::Result::AtEnd:
+        deliverAtEnd();
+        break;
+    case FramePrefetcher::Result::Error:
+        deliverError(msg);
+        break;
     }
 }
 
@@ -229,19 +285,10 @@ SharedDecoder QArvVideoSource::createDecoder()
     return SharedDecoder(new QArvVideoDecoder);
 }
 
-void QArvVideoSource::frameDestroyed(QByteArray frameData)
-{
-    framePool << frameData;
-}
-
 SharedRawFrame QArvVideoSource::createRawFrame()
 {
     auto frame = new QArvVideoFrame;
-    if (!framePool.isEmpty()) {
-        frame->frame = framePool.takeLast();
-    } else {
-        frame->frame.resize(QArvVideoSource::instance->frameBytes);
-    }
+    frame->frame.resize(QArvVideoSource::instance->frameBytes);
     return SharedRawFrame(frame);
 }
 
@@ -254,7 +301,8 @@ QString QArvVideoSource::initialize(QString overrideInput)
 {
     auto name = overrideInput.isEmpty() ? settings.value("file").toString() : overrideInput;
     if (QFileInfo(name).isReadable()) {
-        reader_.reset(new QArvVideoReader(name));
+        int prefetch = settings.value("prefetch", FramePrefetcher::defaultDepth).toInt();
+        reader_.reset(new QArvVideoReader(name, prefetch));
         auto& qv = reader_->qarvVideo;
         if (!qv.status()) {
             return "File error: selected file is not readable.";
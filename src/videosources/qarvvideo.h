@@ -22,6 +22,7 @@
 #define QT_STATICPLUGIN
 
 #include "videosources/interfaces.h"
+#include "videosources/prefetcher.h"
 #include <qarvrecordedvideo.h>
 #include <QLineEdit>
 
@@ -50,11 +51,8 @@ public:
     static QArvVideoSource* instance;
 
 private:
-    void frameDestroyed(QByteArray frameData);
-
     QSize size;
     QScopedPointer<QArvVideoReader> reader_;
-    QList<QByteArray> framePool;
     int frameBytes;
 
     friend class QArvSourceConfigWidget;
@@ -84,13 +82,14 @@ private:
 class QArvVideoFrame: public RawFrame
 {
 public:
-    ~QArvVideoFrame();
     SharedRawFrame copy();
     VideoSourcePlugin* plugin();
     void serialize(QDataStream& s);
     void load(QDataStream& s);
 
 private:
+    // Frame data is read by QArvRecordedVideo, which allocates it itself.
+    // Copies share it implicitly, so frames needn't be pooled.
     QByteArray frame;
     friend class QArvVideoDecoder;
     friend class QArvVideoSource;
@@ -113,7 +112,8 @@ class QArvVideoReader: public Reader
     Q_OBJECT
 
 public:
-    QArvVideoReader(QString filename);
+    QArvVideoReader(QString filename, int prefetch);
+    ~QArvVideoReader();
     bool seek(qint64 frame);
     bool isSequential();
     quint64 numberOfFrames();
@@ -123,7 +123,16 @@ public slots:
     void readFrame();
 
 private:
+    SharedRawFrame fetchFrame(qint64 index, QString* error); // prefetch thread
+
     QArvRecordedVideo qarvVideo;
+    // Once started, only the prefetcher reads qarvVideo, so these are
+    // taken from it beforehand.
+    bool seekable;
+    quint64 frameCount;
+    QScopedPointer<FramePrefetcher> prefetcher;
+    qint64 prefetchPosition = 0;
+    int prefetchDepth;
     friend class QArvVideoSource;
     friend class QArvSourceConfigWidget;
     friend class QArvVideoDecoder;
@@ -24,6 +24,8 @@
 #include <QMessageBox>
 #include <QSettings>
 #include <QTimer>
+#include <QThreadPool>
+#include <cstring>
 extern "C" {
 #include <unistd.h>
 #include <sys/stat.h>
@@ -41,16 +43,12 @@ RawVideoSource::RawVideoSource(QObject* parent): QObject(parent)
     instance = this;
 }
 
-RawVideoFrame::~RawVideoFrame()
-{
-    RawVideoSource::instance->frameDestroyed(frame);
-}
-
 SharedRawFrame RawVideoFrame::copy()
 {
     SharedRawFrame f = RawVideoSource::instance->createRawFrame();
     RawVideoFrame* r = static_cast<RawVideoFrame*>(f.data());
-    *r = *this;
+    memcpy(r->frame.data(), constData(), r->frame.size());
+    r->metaData = metaData;
     return f;
 }
 
@@ -61,12 +59,14 @@ VideoSourcePlugin* RawVideoFrame::plugin()
 
 void RawVideoFrame::serialize(QDataStream& s)
 {
-    s.writeRawData(frame.constData(), frame.size());
+    s.writeRawData(constData(), RawVideoSource::instance->frameBytes);
     RawFrame::serialize(s);
 }
 
 void RawVideoFrame::load(QDataStream& s)
 {
+    mapping.clear();
+    mapped = nullptr;
     frame.resize(RawVideoSource::instance->frameBytes);
     s.readRawData(frame.data(), RawVideoSource::instance->frameBytes);
     RawFrame::load(s);
@@ -88,8 +88,9 @@ VideoSourcePlugin* RawVideoDecoder::plugin()
 const cv::Mat RawVideoDecoder::decode(RawFrame* in)
 {
     auto f = static_cast<RawVideoFrame*>(in);
-    auto c = f->frame.constData();
-    thedecoder->decode(QByteArray::fromRawData(c, f->frame.size()));
+    auto c = f->constData();
+    auto bytes = RawVideoSource::instance->frameBytes;
+    thedecoder->decode(QByteArray::fromRawData(c, bytes));
     return thedecoder->getCvImage();
 }
 
@@ -101,7 +102,8 @@ RawVideoReader::RawVideoReader():
 
 }
 
-RawVideoReader::RawVideoReader(QString filename, bool isLive):
+RawVideoReader::RawVideoReader(QString filename, bool isLive, bool useMmap,
+                               int prefetch, int uringDepth):
     RawVideoReader()
 {
     file.setFileName(filename);
@@ -109,6 +111,27 @@ RawVideoReader::RawVideoReader(QString filename, bool isLive):
     live = file.isSequential() && isLive;
     if (!isSequential()) {
         file.seek(RawVideoSource::instance->headerBytes);
+        if (useMmap) {
+            // Falls back to reading the file if it cannot be mapped,
+            // e.g. when it doesn't fit into the address space.
+            mapping = SharedMappedFile(new MappedFile(filename));
+            if (mapping->isValid())
+                mapping->adviseSequential();
+            else
+                mapping.clear();
+        }
+        if (!mapping && prefetch > 0) {
+            if (uringDepth > 0) {
+                RawVideoSource* s = RawVideoSource::instance;
+                uring.reset(new UringFileReader(file.handle(), s->headerBytes,
+                                                s->frameBytes, uringDepth));
+                if (!uring->isValid())
+                    uring.reset();
+            }
+            using namespace std::placeholders;
+            auto fetch = std::bind(&RawVideoReader::fetchFileFrame, this, _1, _2);
+            prefetcher.reset(new FramePrefetcher(fetch, prefetch));
+        }
     } else {
         setupAsio(file.handle());
     }
@@ -124,6 +147,9 @@ RawVideoReader::RawVideoReader(FILE* processStream, bool isLive):
 
 RawVideoReader::~RawVideoReader()
 {
+    // Stop the prefetching thread before the file goes away.
+    prefetcher.reset();
+    uring.reset();
     // Abort reading operations before object destruction starts.
     // This also quits the background thread.
     service.stop();
@@ -146,48 +172,153 @@ quint64 RawVideoReader::numberOfFrames()
     if (isSequential())
         return 0;
     RawVideoSource* s = RawVideoSource::instance;
-    return (file.size() - s->headerBytes) / s->frameBytes;
+    qint64 size;
+    if (mapping)
+        size = mapping->size();
+    else if (prefetcher)
+        size = QFileInfo(file.fileName()).size(); // 'file' is busy in another thread.
+    else
+        size = file.size();
+    return (size - s->headerBytes) / s->frameBytes;
 }
 
 bool RawVideoReader::seek(qint64 frame)
 {
     if (isSequential())
         return false;
+    if (mapping) {
+        if (frame < 0 || frame > (qint64)numberOfFrames())
+            return false;
+        mappedPosition = frame;
+        advisedUntil = frame;
+        return true;
+    }
+    if (prefetcher) {
+        if (frame < 0 || frame > (qint64)numberOfFrames())
+            return false;
+        prefetcher->seek(frame);
+        return true;
+    }
     RawVideoSource* s = RawVideoSource::instance;
     return file.seek(frame * s->frameBytes + s->headerBytes);
 }
 
+void RawVideoReader::readMappedFrame()
+{
+    RawVideoSource* s = RawVideoSource::instance;
+    if (mappedPosition >= (qint64)numberOfFrames()) {
+        deliverAtEnd();
+        return;
+    }
+    // Keep the kernel reading ahead by as many frames as the foreman
+    // can have in flight, renewing the advice once half of it is used.
+    qint64 window = 2 * QThreadPool::globalInstance()->maxThreadCount();
+    if (mappedPosition + window / 2 >= advisedUntil) {
+        qint64 from = qMax(advisedUntil, mappedPosition);
+        advisedUntil = mappedPosition + window;
+        mapping->adviseWillNeed(s->headerBytes + from * s->frameBytes,
+                                (advisedUntil - from) * s->frameBytes);
+    }
+    auto f = new RawVideoFrame;
+    f->mapping = mapping;
+    f->mapped = mapping->data() + s->headerBytes +
+                mappedPosition * s->frameBytes;
+    mappedPosition++;
+    f->metaData = makeMetaData();
+    deliverFrame(SharedRawFrame(f));
+}
+
+SharedRawFrame RawVideoReader::fetchFileFrame(qint64 index, QString* error)
+{
+    RawVideoSource* s = RawVideoSource::instance;
+    if (!file.isOpen()) {
+        *error = "Error opening file.";
+        return SharedRawFrame();
+    }
+    qint64 position = s->headerBytes + index * s->frameBytes;
+    if (uring) {
+        if (index != uringPosition)
+            uring->seek(position);
+        uringPosition = index + 1;
+        auto f = new RawVideoFrame;
+        SharedRawFrame frm(f);
+        qint64 status = uring->next(&f->frame);
+        if (status < 0) {
+            *error = "Error reading file: ";
+            *error += QString::fromLocal8Bit(strerror(-status));
+            return SharedRawFrame();
+        } else if (status < s->frameBytes) {
+            return SharedRawFrame();
+        }
+        return frm;
+    }
+    if (file.pos() != position && !file.seek(position)) {
+        *error = "Error reading file.";
+        return SharedRawFrame();
+    }
+    SharedRawFrame frm = s->createRawFrame();
+    RawVideoFrame* f = static_cast<RawVideoFrame*>(frm.data());
+    qint64 status = file.read(f->frame.data(), s->frameBytes);
+    if (status < 0) {
+        *error = "Error reading file.";
+        return SharedRawFrame();
+    } else if (status < s->frameBytes) {
+        return SharedRawFrame();
+    }
+    return frm;
+}
+
 void RawVideoReader::readFrame()
 {
     RawVideoSource* s = RawVideoSource::instance;
-    if (!isSequential()) {
+    if (mapping) {
+        readMappedFrame();
+    } else if (prefetcher) {
+        SharedRawFrame frm;
+        QString msg;
+        switch (prefetcher->take(&frm, &msg)) {
+        case FramePrefetcher::Result::Frame: {
+            qint64 arrival = frm->metaData.arrival;
+            frm->metaData = makeMetaData();
+            frm->metaData.arrival = arrival;
+            deliverFrame(frm);
+            break;
+        }
+        case FramePrefetcher::Result::AtEnd:
+            deliverAtEnd();
+            break;
+        case FramePrefetcher::Result::Error:
+            deliverError(msg);
+            break;
+        }
+    } else if (!isSequential()) {
         SharedRawFrame frm = s->createRawFrame();
         RawVideoFrame* f = static_cast<RawVideoFrame*>(frm.data());
         if (file.isOpen()) {
             qint64 status;
             status = file.read(f->frame.data(), s->frameBytes);
             if (status < 0) {
-                emit error("Error reading file.");
+                deliverError("Error reading file.");
             } else if (status < s->frameBytes) {
-                emit atEnd();
+                deliverAtEnd();
             } else {
                 frm->metaData = makeMetaData();
-                emit frameReady(frm);
+                deliverFrame(frm);
             }
         } else {
-            emit error("Error opening file.");
+            deliverError("Error opening file.");
         }
     } else {
         if (errcode) {
             QString msg = "Error reading data: ";
             msg += QString::fromStdString(errcode.message());
-            emit error(msg);
+            deliverError(msg);
             return;
         }
         if (!live) {
             if (!frameQueue.isEmpty()) {
                 bool full = frameQueue.size() == frameQueueMax;
-                emit frameReady(frameQueue.dequeue());
+                deliverFrame(frameQueue.dequeue());
                 if (full) {
                     // Reading was stopped, start it again.
                     asioRead();
@@ -204,15 +335,15 @@ void RawVideoReader::readFrame()
 void RawVideoReader::asyncReadComplete(SharedRawFrame frame, QString err)
 {
     if (!err.isNull()) {
-            emit error(err);
+            deliverError(err);
     } else {
+        qint64 arrival = frame->metaData.arrival;
         frame->metaData = makeMetaData();
-        if (live) {
-            emit frameReady(frame);
-        } else if (readerSlowEmitNextFrame) {
+        frame->metaData.arrival = arrival;
+        if (readerSlowEmitNextFrame) {
             readerSlowEmitNextFrame = false;
             asioRead();
-            emit frameReady(frame);
+            deliverFrame(frame);
         } else {
             frameQueue.enqueue(frame);
             if (frameQueue.size() < frameQueueMax)
@@ -221,27 +352,22 @@ void RawVideoReader::asyncReadComplete(SharedRawFrame frame, QString err)
     }
 }
 
+void RawVideoReader::liveFramesReady()
+{
+    QVector<SharedRawFrame> frames;
+    liveMutex.lock();
+    frames.swap(liveFrames);
+    liveMutex.unlock();
+    for (auto& frame: frames) {
+        qint64 arrival = frame->metaData.arrival;
+        frame->metaData = makeMetaData();
+        frame->metaData.arrival = arrival;
+    }
+    deliverFrames(frames);
+}
+
 void RawVideoReader::setupAsio(int fd)
 {
-    RawVideoSource* s = RawVideoSource::instance;
-    currentlyReadFrame = s->createRawFrame();
-    auto frame = currentlyReadFrame;
-    asyncHandler = [this, frame]
-                   (const boost::system::error_code & err,
-                    std::size_t bytes)
-    {
-        QString msg;
-        if (err) {
-            msg = "Error reading data: ";
-            msg += QString::fromStdString(err.message());
-        }
-        QMetaObject::invokeMethod(this, "asyncReadComplete",
-                                  Qt::QueuedConnection,
-                                  Q_ARG(SharedRawFrame, frame->copy()),
-                                  Q_ARG(QString, msg));
-        if (live && msg.isEmpty())
-            asioRead();
-    };
     stream = decltype(stream)(service, fd);
 
     // Read the header.
@@ -266,9 +392,42 @@ void RawVideoReader::setupAsio(int fd)
 void RawVideoReader::asioRead()
 {
     RawVideoSource* s = RawVideoSource::instance;
-    RawVideoFrame* f = static_cast<RawVideoFrame*>(currentlyReadFrame.data());
+    // Every read goes into a fresh buffer from the pool and the frame is
+    // passed on as it is, so that its data needn't be copied.
+    SharedRawFrame frame = s->createRawFrame();
+    RawVideoFrame* f = static_cast<RawVideoFrame*>(frame.data());
     auto buf = boost::asio::buffer(f->frame.data(), s->frameBytes);
-    boost::asio::async_read(stream, buf, asyncHandler);
+    auto handler = [this, frame]
+                   (const boost::system::error_code & err,
+                    std::size_t bytes)
+    {
+        QString msg;
+        if (err) {
+            msg = "Error reading data: ";
+            msg += QString::fromStdString(err.message());
+        }
+        // The rest of the metadata is filled in by the main thread, but
+        // the frame arrived now.
+        frame->metaData.arrival = monotonicTime();
+        if (live && msg.isEmpty()) {
+            // Frames that arrive while the main thread is busy are
+            // delivered together once it gets to them.
+            liveMutex.lock();
+            bool first = liveFrames.isEmpty();
+            liveFrames << frame;
+            liveMutex.unlock();
+            if (first)
+                QMetaObject::invokeMethod(this, "liveFramesReady",
+                                          Qt::QueuedConnection);
+            asioRead();
+        } else {
+            QMetaObject::invokeMethod(this, "asyncReadComplete",
+                                      Qt::QueuedConnection,
+                                      Q_ARG(SharedRawFrame, frame),
+                                      Q_ARG(QString, msg));
+        }
+    };
+    boost::asio::async_read(stream, buf, handler);
 }
 
 static void populateFormatSelector(QComboBox* sel)
@@ -323,6 +482,9 @@ RawSourceConfigWidget::RawSourceConfigWidget() :
     liveCheckBox = new QCheckBox("Live data, read continuously");
     layout->addRow(liveCheckBox);
 
+    mmapCheckBox = new QCheckBox("Map seekable files into memory");
+    layout->addRow(mmapCheckBox);
+
     auto finishButton = new QPushButton("Finish");
     layout->addRow(finishButton);
     this->connect(finishButton, SIGNAL(clicked(bool)), SLOT(checkConfig()));
@@ -331,10 +493,13 @@ RawSourceConfigWidget::RawSourceConfigWidget() :
 
 void RawSourceConfigWidget::checkFilename(QString name)
 {
-    if (QFileInfo(name).isFile())
+    if (QFileInfo(name).isFile()) {
         liveCheckBox->setEnabled(false);
-    else
+        mmapCheckBox->setEnabled(true);
+    } else {
         liveCheckBox->setEnabled(true);
+        mmapCheckBox->setEnabled(false);
+    }
 }
 
 void RawSourceConfigWidget::checkConfig()
@@ -372,6 +537,7 @@ void RawSourceConfigWidget::saveConfig()
     s->settings.insert("width", width->value());
     s->settings.insert("height", height->value());
     s->settings.insert("live", liveCheckBox->isChecked());
+    s->settings.insert("mmap", mmapCheckBox->isChecked());
 }
 
 void RawSourceConfigWidget::restoreConfig()
@@ -385,6 +551,7 @@ void RawSourceConfigWidget::restoreConfig()
     width->setValue(s->settings.value("width", 640).toInt());
     height->setValue(s->settings.value("height", 480).toInt());
     liveCheckBox->setChecked(s->settings.value("live", false).toBool());
+    mmapCheckBox->setChecked(s->settings.value("mmap", true).toBool());
 }
 
 QString RawVideoSource::name()
@@ -407,19 +574,11 @@ SharedDecoder RawVideoSource::createDecoder()
     return SharedDecoder(new RawVideoDecoder);
 }
 
-void RawVideoSource::frameDestroyed(QByteArray frameData)
-{
-    framePool << frameData;
-}
-
 SharedRawFrame RawVideoSource::createRawFrame()
 {
     auto frame = new RawVideoFrame;
-    if (!framePool.isEmpty()) {
-        frame->frame = framePool.takeLast();
-    } else {
-        frame->frame.resize(RawVideoSource::instance->frameBytes);
-    }
+    // Buffers of destroyed frames are recycled by the BufferPool.
+    frame->frame.resize(RawVideoSource::instance->frameBytes);
     return SharedRawFrame(frame);
 }
 
@@ -442,8 +601,12 @@ QString RawVideoSource::initialize(QString overrideInput)
     headerBytes = settings.value("header_bytes").toInt();
     frameBytes = av_image_get_buffer_size(pixfmt, size.width(), size.height(), 1);
     bool isLive = settings.value("live", false).toBool();
+    bool useMmap = settings.value("mmap", true).toBool();
+    int prefetch = settings.value("prefetch", FramePrefetcher::defaultDepth).toInt();
+    int uringDepth = settings.value("uring_depth", UringFileReader::defaultDepth).toInt();
 
     auto& name = file;
+    inputPath.clear();
     if (name.startsWith('<') ||
         name.startsWith('>') ||
         name.startsWith('|')) {
@@ -456,7 +619,10 @@ QString RawVideoSource::initialize(QString overrideInput)
         reader_.reset(new RawVideoReader(process, isLive));
         return QString {};
     } else if (QFileInfo(name).isReadable()) {
-        reader_.reset(new RawVideoReader(name, isLive));
+        reader_.reset(new RawVideoReader(name, isLive, useMmap, prefetch,
+                                              uringDepth));
+        if (!isLive)
+            inputPath = name;
         return QString {};
     } else {
         return "File error: Selected file is not readable.";
@@ -22,6 +22,11 @@
 #define QT_STATICPLUGIN
 
 #include "videosources/interfaces.h"
+#include "videosources/mappedfile.h"
+#include "videosources/prefetcher.h"
+#include "videosources/uringfile.h"
+#include "affinity.h"
+#include "bufferpool.h"
 #include <qarvdecoder.h>
 #include <QLineEdit>
 #include <QSpinBox>
@@ -31,6 +36,7 @@
 #include <QMetaType>
 #include <QThread>
 #include <QQueue>
+#include <QMutex>
 #include <boost/asio.hpp>
 #include <functional>
 #include <cstdio>
@@ -60,15 +66,12 @@ public:
     static RawVideoSource* instance;
 
 private:
-    void frameDestroyed(QByteArray frameData);
-
     QSize size;
     QString file;
     QScopedPointer<RawVideoReader> reader_;
     enum AVPixelFormat pixfmt;
     uint headerBytes;
     int frameBytes;
-    QList<QByteArray> framePool;
 
     friend class RawSourceConfigWidget;
     friend class RawVideoFrame;
@@ -95,20 +98,27 @@ private:
     QLineEdit* fileName;
     QSpinBox* width, * height, * header;
     QCheckBox* liveCheckBox;
+    QCheckBox* mmapCheckBox;
     QComboBox* formatSelector;
 };
 
 class RawVideoFrame: public RawFrame
 {
 public:
-    ~RawVideoFrame();
     SharedRawFrame copy();
     VideoSourcePlugin* plugin();
     void serialize(QDataStream& s);
     void load(QDataStream& s);
 
 private:
-    QByteArray frame;
+    const char* constData() const {
+        return mapped ? mapped : frame.constData();
+    }
+
+    // Frames either own a buffer or point into a mapped file.
+    FrameBuffer frame;
+    SharedMappedFile mapping;
+    const char* mapped = nullptr;
     friend class RawVideoDecoder;
     friend class RawVideoSource;
     friend class RawVideoReader;
@@ -135,6 +145,7 @@ public:
         QThread(), serviceptr(service) {}
 
     void run() {
+        pinCurrentThread(ThreadRole::Reader);
         serviceptr->run();
     }
 
@@ -148,7 +159,8 @@ class RawVideoReader: public Reader
     Q_OBJECT
 
 public:
-    RawVideoReader(QString filename, bool isLive);
+    RawVideoReader(QString filename, bool isLive, bool useMmap, int prefetch,
+                   int uringDepth);
     RawVideoReader(std::FILE* processStream, bool isLive);
     ~RawVideoReader();
     bool seek(qint64 frame);
@@ -161,25 +173,36 @@ public slots:
 
 private slots:
     void asyncReadComplete(SharedRawFrame frame, QString error);
+    void liveFramesReady();
 
 private:
     RawVideoReader();
     void setupAsio(int fd);
     void asioRead(); // called from asio thread when live, main thread otherwise.
-    typedef std::function<void(const boost::system::error_code&,
-                               std::size_t)> asyncHandlerType;
+    void readMappedFrame();
+    SharedRawFrame fetchFileFrame(qint64 index, QString* error); // prefetch thread
 
     boost::asio::io_service service;
     boost::asio::posix::stream_descriptor stream;
     boost::asio::io_service::work work;
     boost::system::error_code errcode;
     QFile file;
+    // When set, seekable files are read from the mapping instead of 'file'.
+    SharedMappedFile mapping;
+    qint64 mappedPosition = 0; // In frames.
+    qint64 advisedUntil = 0;   // Frames up to here were advised to the kernel.
+    // Otherwise, seekable files are read in the background by this.
+    QScopedPointer<FramePrefetcher> prefetcher;
+    // If available, the prefetcher reads through this instead of 'file'.
+    QScopedPointer<UringFileReader> uring;
+    qint64 uringPosition = 0; // In frames.
     std::FILE* process = nullptr;
     AsioThread asioThread;
     bool live;
-    SharedRawFrame currentlyReadFrame;
     QQueue<SharedRawFrame> frameQueue;
-    asyncHandlerType asyncHandler;
+    // Live frames read since the main thread last took them.
+    QMutex liveMutex;
+    QVector<SharedRawFrame> liveFrames;
     bool readerSlowEmitNextFrame = false;
     friend class RawVideoSource;
 };
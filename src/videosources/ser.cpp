@@ -0,0 +1,338 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "videosources/ser.h"
+#include <QFormLayout>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileDialog>
+#include <QPushButton>
+#include <QMessageBox>
+#include <QThreadPool>
+#include <QtEndian>
+#include <cstring>
+extern "C" {
+#include <libavutil/pixfmt.h>
+#include <libswscale/swscale.h>
+}
+
+using namespace SerVideo;
+
+SerSource* SerSource::instance;
+
+SerSource::SerSource(QObject* parent): QObject(parent)
+{
+    instance = this;
+}
+
+SharedRawFrame SerFrame::copy()
+{
+    SharedRawFrame f = SerSource::instance->createRawFrame();
+    SerFrame* r = static_cast<SerFrame*>(f.data());
+    memcpy(r->frame.data(), constData(), r->frame.size());
+    r->metaData = metaData;
+    return f;
+}
+
+VideoSourcePlugin* SerFrame::plugin()
+{
+    return SerSource::instance;
+}
+
+void SerFrame::serialize(QDataStream& s)
+{
+    s.writeRawData(constData(), SerSource::instance->frameBytes);
+    RawFrame::serialize(s);
+}
+
+void SerFrame::load(QDataStream& s)
+{
+    mapping.clear();
+    mapped = nullptr;
+    frame.resize(SerSource::instance->frameBytes);
+    s.readRawData(frame.data(), SerSource::instance->frameBytes);
+    RawFrame::load(s);
+}
+
+SerDecoder::SerDecoder()
+{
+    auto s = SerSource::instance;
+    QSize size(s->header.width, s->header.height);
+    auto d = QArvDecoder::makeSwScaleDecoder(s->pixfmt, size,
+             SWS_FAST_BILINEAR | SWS_BITEXACT);
+    thedecoder.reset(d);
+}
+
+VideoSourcePlugin* SerDecoder::plugin()
+{
+    return SerSource::instance;
+}
+
+const cv::Mat SerDecoder::decode(RawFrame* in)
+{
+    auto f = static_cast<SerFrame*>(in);
+    auto bytes = SerSource::instance->frameBytes;
+    thedecoder->decode(QByteArray::fromRawData(f->constData(), bytes));
+    return thedecoder->getCvImage();
+}
+
+SerReader::SerReader(SharedMappedFile file): mapping(file)
+{
+    auto s = SerSource::instance;
+    qint64 available = (mapping->size() - Ser::Header::size) / s->frameBytes;
+    // Some programs don't update the count if capture is interrupted.
+    frames = s->header.frameCount > 0 ?
+             qMin<qint64>(s->header.frameCount, available) : available;
+    qint64 trailerStart = Ser::Header::size + frames * s->frameBytes;
+    if (frames == s->header.frameCount &&
+        mapping->size() >= trailerStart + frames * 8)
+        trailer = mapping->data() + trailerStart;
+    mapping->adviseSequential();
+}
+
+bool SerReader::seek(qint64 frame)
+{
+    if (frame < 0 || frame > frames)
+        return false;
+    position = frame;
+    advisedUntil = frame;
+    return true;
+}
+
+bool SerReader::isSequential()
+{
+    return false;
+}
+
+quint64 SerReader::numberOfFrames()
+{
+    return frames;
+}
+
+VideoSourcePlugin* SerReader::plugin()
+{
+    return SerSource::instance;
+}
+
+void SerReader::readFrame()
+{
+    auto s = SerSource::instance;
+    if (position >= frames) {
+        deliverAtEnd();
+        return;
+    }
+    // Same read-ahead scheme as the memory-mapped raw video reader.
+    qint64 window = 2 * QThreadPool::globalInstance()->maxThreadCount();
+    if (position + window / 2 >= advisedUntil) {
+        qint64 from = qMax(advisedUntil, position);
+        advisedUntil = position + window;
+        mapping->adviseWillNeed(Ser::Header::size + from * s->frameBytes,
+                                (advisedUntil - from) * s->frameBytes);
+    }
+    auto f = new SerFrame;
+    f->mapping = mapping;
+    f->mapped = mapping->data() + Ser::Header::size + position * s->frameBytes;
+    if (trailer) {
+        auto p = reinterpret_cast<const uchar*>(trailer) + position * 8;
+        f->metaData = makeMetaData(Ser::fromTicks(qFromLittleEndian<qint64>(p)));
+    } else {
+        f->metaData = makeMetaData();
+    }
+    position++;
+    deliverFrame(SharedRawFrame(f));
+}
+
+// Returns AV_PIX_FMT_NONE for formats that swscale can't read.
+static AVPixelFormat pixelFormat(const Ser::Header& h)
+{
+    bool wide = h.bytesPerSample() > 1;
+    bool be = h.isBigEndian();
+    switch (h.colorId) {
+    case Ser::Mono:
+        return !wide ? AV_PIX_FMT_GRAY8 :
+               be ? AV_PIX_FMT_GRAY16BE : AV_PIX_FMT_GRAY16LE;
+    case Ser::BayerRGGB:
+        return !wide ? AV_PIX_FMT_BAYER_RGGB8 :
+               be ? AV_PIX_FMT_BAYER_RGGB16BE : AV_PIX_FMT_BAYER_RGGB16LE;
+    case Ser::BayerGRBG:
+        return !wide ? AV_PIX_FMT_BAYER_GRBG8 :
+               be ? AV_PIX_FMT_BAYER_GRBG16BE : AV_PIX_FMT_BAYER_GRBG16LE;
+    case Ser::BayerGBRG:
+        return !wide ? AV_PIX_FMT_BAYER_GBRG8 :
+               be ? AV_PIX_FMT_BAYER_GBRG16BE : AV_PIX_FMT_BAYER_GBRG16LE;
+    case Ser::BayerBGGR:
+        return !wide ? AV_PIX_FMT_BAYER_BGGR8 :
+               be ? AV_PIX_FMT_BAYER_BGGR16BE : AV_PIX_FMT_BAYER_BGGR16LE;
+    case Ser::RGB:
+        return !wide ? AV_PIX_FMT_RGB24 :
+               be ? AV_PIX_FMT_RGB48BE : AV_PIX_FMT_RGB48LE;
+    case Ser::BGR:
+        return !wide ? AV_PIX_FMT_BGR24 :
+               be ? AV_PIX_FMT_BGR48BE : AV_PIX_FMT_BGR48LE;
+    default:
+        return AV_PIX_FMT_NONE;
+    }
+}
+
+SerSourceConfigWidget::SerSourceConfigWidget() :
+    VideoSourceConfigurationWidget("SER video configuration")
+{
+    auto layout = new QFormLayout(this);
+    auto fileInputRow = new QHBoxLayout();
+    fileName = new QLineEdit();
+    auto openFileDialog = new QPushButton("Open");
+    auto icon = QIcon::fromTheme("document-open");
+    if (!icon.isNull()) {
+        openFileDialog->setText("");
+        openFileDialog->setIcon(icon);
+    }
+    fileInputRow->addWidget(fileName);
+    fileInputRow->addWidget(openFileDialog);
+    layout->addRow("Input file:", fileInputRow);
+    this->connect(openFileDialog, SIGNAL(clicked(bool)), SLOT(getFile()));
+    connect(fileName, SIGNAL(textChanged(QString)), SLOT(describeFile(QString)));
+
+    description = new QLabel;
+    layout->addRow(description);
+
+    auto finishButton = new QPushButton("Finish");
+    layout->addRow(finishButton);
+    this->connect(finishButton, SIGNAL(clicked(bool)), SLOT(checkConfig()));
+    restoreConfig();
+}
+
+void SerSourceConfigWidget::describeFile(QString name)
+{
+    QFile file(name);
+    Ser::Header h;
+    QString error;
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = "File is not readable.";
+    } else {
+        auto data = file.read(Ser::Header::size);
+        error = h.parse(data.constData(), data.size());
+    }
+    if (!error.isEmpty()) {
+        description->setText(error);
+        return;
+    }
+    description->setText(QString("%1x%2, %3 bits, %4 frames")
+                         .arg(h.width).arg(h.height)
+                         .arg(h.pixelDepth).arg(h.frameCount));
+}
+
+void SerSourceConfigWidget::checkConfig()
+{
+    SerSource* s = SerSource::instance;
+    saveConfig();
+    auto result = s->initialize();
+    if (result.isNull()) {
+        s->saveSettings();
+        emit configurationComplete();
+    } else {
+        QMessageBox tmp;
+        tmp.setWindowTitle("Error");
+        tmp.setText(result);
+        tmp.exec();
+    }
+}
+
+void SerSourceConfigWidget::getFile()
+{
+    auto tmp = QFileDialog::getOpenFileName(this,
+                                            "Open SER video file",
+                                            fileName->text(),
+                                            "SER videos (*.ser *.SER)");
+    if (!tmp.isNull())
+        fileName->setText(tmp);
+}
+
+void SerSourceConfigWidget::saveConfig()
+{
+    auto s = SerSource::instance;
+    s->settings.insert("file", fileName->text());
+}
+
+void SerSourceConfigWidget::restoreConfig()
+{
+    auto s = SerSource::instance;
+    s->readSettings();
+    fileName->setText(s->settings.value("file").toString());
+}
+
+QString SerSource::name()
+{
+    return "SER";
+}
+
+QString SerSource::readableName()
+{
+    return "SER video file";
+}
+
+VideoSourceConfigurationWidget* SerSource::createConfigurationWidget()
+{
+    return new SerSourceConfigWidget;
+}
+
+SharedDecoder SerSource::createDecoder()
+{
+    return SharedDecoder(new SerDecoder);
+}
+
+SharedRawFrame SerSource::createRawFrame()
+{
+    auto frame = new SerFrame;
+    frame->frame.resize(SerSource::instance->frameBytes);
+    return SharedRawFrame(frame);
+}
+
+Reader* SerSource::reader()
+{
+    return reader_.data();
+}
+
+QString SerSource::settingsGroup()
+{
+    return "format_" + SerSource::instance->name();
+}
+
+QString SerSource::initialize(QString overrideInput)
+{
+    auto file = overrideInput.isNull() ? settings.value("file").toString() : overrideInput;
+    auto mapping = SharedMappedFile(new MappedFile(file));
+    if (!mapping->isValid())
+        return "File error: Selected file is not readable.";
+    Ser::Header h;
+    auto error = h.parse(mapping->data(), mapping->size());
+    if (!error.isEmpty())
+        return "File error: " + error;
+    auto fmt = pixelFormat(h);
+    if (fmt == AV_PIX_FMT_NONE)
+        return "File error: Unsupported SER color format.";
+    if (mapping->size() < Ser::Header::size + h.frameBytes())
+        return "File error: SER video contains no frames.";
+    header = h;
+    pixfmt = fmt;
+    frameBytes = h.frameBytes();
+    reader_.reset(new SerReader(mapping));
+    inputPath = file;
+    return QString {};
+}
+
+Q_IMPORT_PLUGIN(SerSource)
@@ -0,0 +1,145 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SER_H
+#define SER_H
+
+#define QT_STATICPLUGIN
+
+#include "videosources/interfaces.h"
+#include "videosources/mappedfile.h"
+#include "bufferpool.h"
+#include "serformat.h"
+#include <qarvdecoder.h>
+#include <QLineEdit>
+#include <QLabel>
+
+namespace SerVideo
+{
+
+class SerReader;
+
+class SerSource: public QObject, public VideoSourcePlugin
+{
+    Q_OBJECT
+    Q_INTERFACES(VideoSourcePlugin)
+    Q_PLUGIN_METADATA(IID "si.ad-vega.arif.SerSource")
+
+public:
+    explicit SerSource(QObject* parent = 0);
+    QString name();
+    QString readableName();
+    VideoSourceConfigurationWidget* createConfigurationWidget();
+    SharedRawFrame createRawFrame();
+    SharedDecoder createDecoder();
+    Reader* reader();
+    QString settingsGroup();
+    QString initialize(QString overrideInput = QString{});
+
+    static SerSource* instance;
+
+private:
+    Ser::Header header;
+    enum AVPixelFormat pixfmt;
+    int frameBytes;
+    QScopedPointer<SerReader> reader_;
+
+    friend class SerSourceConfigWidget;
+    friend class SerFrame;
+    friend class SerReader;
+    friend class SerDecoder;
+};
+
+class SerSourceConfigWidget : public VideoSourceConfigurationWidget
+{
+    Q_OBJECT
+
+public:
+    explicit SerSourceConfigWidget();
+
+private slots:
+    void checkConfig();
+    void getFile();
+    void describeFile(QString name);
+
+private:
+    void saveConfig();
+    void restoreConfig();
+
+    QLineEdit* fileName;
+    QLabel* description;
+};
+
+class SerFrame: public RawFrame
+{
+public:
+    SharedRawFrame copy();
+    VideoSourcePlugin* plugin();
+    void serialize(QDataStream& s);
+    void load(QDataStream& s);
+
+private:
+    const char* constData() const {
+        return mapped ? mapped : frame.constData();
+    }
+
+    // Frames point into the mapped file, unless they were loaded.
+    FrameBuffer frame;
+    SharedMappedFile mapping;
+    const char* mapped = nullptr;
+    friend class SerDecoder;
+    friend class SerSource;
+    friend class SerReader;
+};
+
+class SerDecoder: public Decoder
+{
+public:
+    SerDecoder();
+    const cv::Mat decode(RawFrame* in);
+    VideoSourcePlugin* plugin();
+
+private:
+    QScopedPointer<QArvDecoder> thedecoder;
+};
+
+class SerReader: public Reader
+{
+    Q_OBJECT
+
+public:
+    SerReader(SharedMappedFile file);
+    bool seek(qint64 frame);
+    bool isSequential();
+    quint64 numberOfFrames();
+    VideoSourcePlugin* plugin();
+
+public slots:
+    void readFrame();
+
+private:
+    SharedMappedFile mapping;
+    qint64 frames;
+    const char* trailer = nullptr; // Timestamps, if present.
+    qint64 position = 0;
+    qint64 advisedUntil = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,535 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "videosources/synthetic.h"
+#include "affinity.h"
+#include <QFormLayout>
+#include <QPushButton>
+#include <QMessageBox>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+#include <QDebug>
+#include <QtEndian>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cmath>
+#include <vector>
+
+using namespace Synthetic;
+
+static const double pi = 3.14159265358979323846;
+
+SharedRawFrame SyntheticFrame::copy()
+{
+    auto f = new SyntheticFrame;
+    *f = *this;
+    return SharedRawFrame(f);
+}
+
+VideoSourcePlugin* SyntheticFrame::plugin()
+{
+    return SyntheticSource::instance;
+}
+
+void SyntheticFrame::serialize(QDataStream& s)
+{
+    s << frame;
+    RawFrame::serialize(s);
+}
+
+void SyntheticFrame::load(QDataStream& s)
+{
+    s >> frame;
+    RawFrame::load(s);
+}
+
+SyntheticDecoder::SyntheticDecoder(ArvPixelFormat pixfmt, QSize size):
+    thedecoder(QArvDecoder::makeDecoder(pixfmt, size, true))
+{
+
+}
+
+const cv::Mat SyntheticDecoder::decode(RawFrame* in)
+{
+    auto f = static_cast<SyntheticFrame*>(in);
+    thedecoder->decode(f->frame);
+    return thedecoder->getCvImage();
+}
+
+VideoSourcePlugin* SyntheticDecoder::plugin()
+{
+    return SyntheticSource::instance;
+}
+
+void PacingThread::stop()
+{
+    quit = true;
+    wait();
+}
+
+void PacingThread::run()
+{
+    pinCurrentThread(ThreadRole::Reader);
+    const qint64 interval = 1e9 / fps;
+    // Sleep in short steps, so that stopping doesn't wait for slow rates.
+    const qint64 maxSleep = 100000000;
+    qint64 next = monotonicTime();
+    while (!quit) {
+        qint64 now = monotonicTime();
+        if (now < next) {
+            QThread::usleep(qMin(next - now, maxSleep) / 1000);
+            continue;
+        }
+        if (!reader->pace())
+            break;
+        next += interval;
+        // Don't make up for a long stall with a burst of frames.
+        if (now - next > 1000000000)
+            next = now;
+    }
+}
+
+SyntheticReader::SyntheticReader(QVector<QByteArray> pool_, qint64 frames_,
+                                 bool live_, double fps, int queueLimit_):
+    pool(pool_), frames(frames_), live(live_), pacer(this, fps),
+    queueLimit(queueLimit_)
+{
+    if (live)
+        pacer.start();
+}
+
+SyntheticReader::~SyntheticReader()
+{
+    pacer.stop();
+    if (dropped > 0)
+        qDebug() << "Synthetic source dropped" << dropped << "frames.";
+}
+
+VideoSourcePlugin* SyntheticReader::plugin()
+{
+    return SyntheticSource::instance;
+}
+
+bool SyntheticReader::isSequential()
+{
+    return live || frames == 0;
+}
+
+quint64 SyntheticReader::numberOfFrames()
+{
+    return isSequential() ? 0 : frames;
+}
+
+bool SyntheticReader::seek(qint64 frame)
+{
+    if (isSequential() || frame < 0 || frame > frames)
+        return false;
+    position = frame;
+    return true;
+}
+
+SharedRawFrame SyntheticReader::makeFrame(qint64 index)
+{
+    auto f = new SyntheticFrame;
+    f->frame = pool.at(index % pool.size());
+    return SharedRawFrame(f);
+}
+
+void SyntheticReader::readFrame()
+{
+    if (live)
+        return;
+    if (frames > 0 && position >= frames) {
+        deliverAtEnd();
+        return;
+    }
+    auto frame = makeFrame(position++);
+    frame->metaData = makeMetaData();
+    deliverFrame(frame);
+}
+
+bool SyntheticReader::pace()
+{
+    bool atEnd = frames > 0 && position >= frames;
+    SharedRawFrame frame;
+    if (!atEnd) {
+        frame = makeFrame(position++);
+        // This is when a camera would have delivered it.
+        frame->metaData.arrival = monotonicTime();
+    }
+    liveMutex.lock();
+    bool first = liveFrames.isEmpty() && !liveAtEnd;
+    if (atEnd)
+        liveAtEnd = true;
+    else if (liveFrames.size() < queueLimit)
+        liveFrames << frame;
+    else
+        dropped++;
+    liveMutex.unlock();
+    if (first)
+        QMetaObject::invokeMethod(this, "liveFramesReady", Qt::QueuedConnection);
+    return !atEnd;
+}
+
+void SyntheticReader::liveFramesReady()
+{
+    QVector<SharedRawFrame> taken;
+    liveMutex.lock();
+    taken.swap(liveFrames);
+    bool atEnd = liveAtEnd;
+    liveMutex.unlock();
+    for (auto& frame: taken) {
+        qint64 arrival = frame->metaData.arrival;
+        frame->metaData = makeMetaData();
+        frame->metaData.arrival = arrival;
+    }
+    deliverFrames(taken);
+    if (atEnd)
+        deliverAtEnd();
+}
+
+// A banded disk with limb darkening, a few storms and fine turbulence,
+// in BGR with values between 0 and 1. Detail between 0 and 1 sets the
+// number and contrast of the features.
+static cv::Mat makePlanet(cv::Size size, double radius, double detail,
+                          cv::RNG& rng)
+{
+    const cv::Vec3f light(0.85, 0.95, 1.0), dark(0.45, 0.6, 0.8);
+    double bands = 3 + 12 * detail;
+    double phase = rng.uniform(0., 2 * pi);
+    struct Storm { double x, y, size, strength; };
+    std::vector<Storm> storms(std::lround(20 * detail));
+    for (auto& s: storms)
+        s = {rng.uniform(-0.7, 0.7), rng.uniform(-0.7, 0.7),
+             rng.uniform(0.02, 0.1), rng.uniform(-0.5, 0.5)};
+    // Turbulence at a scale of a few pixels, which seeing washes out.
+    cv::Mat turbulence(std::max(size.height / 4, 1),
+                       std::max(size.width / 4, 1), CV_32F);
+    rng.fill(turbulence, cv::RNG::NORMAL, 0, 0.15 * detail);
+    cv::resize(turbulence, turbulence, size, 0, 0, cv::INTER_CUBIC);
+
+    cv::Mat_<cv::Vec3f> planet(size, cv::Vec3f(0, 0, 0));
+    double cx = size.width / 2., cy = size.height / 2.;
+    for (int y = 0; y < size.height; y++) {
+        for (int x = 0; x < size.width; x++) {
+            double dx = (x - cx) / radius, dy = (y - cy) / radius;
+            double rho2 = dx * dx + dy * dy;
+            if (rho2 >= 1)
+                continue;
+            double limb = 0.4 + 0.6 * std::sqrt(1 - rho2);
+            double band = 0.5 + 0.5 * std::sin(dy * bands * pi + phase);
+            double mix = 0.5 + (band - 0.5) * (0.2 + 0.8 * detail);
+            for (auto& s: storms) {
+                double sx = (dx - s.x) / s.size, sy = (dy - s.y) / (s.size / 2);
+                mix += s.strength * std::exp(-(sx * sx + sy * sy));
+            }
+            mix += turbulence.at<float>(y, x);
+            mix = std::min(std::max(mix, 0.), 1.);
+            planet(y, x) = limb * (mix * light + (1 - mix) * dark);
+        }
+    }
+    return planet;
+}
+
+// Converts to the raw layout of the pixel format, packed and little endian.
+static QByteArray toRaw(const cv::Mat& bgr, ArvPixelFormat pixfmt)
+{
+    bool wide = pixfmt == ARV_PIXEL_FORMAT_MONO_16 ||
+                pixfmt == ARV_PIXEL_FORMAT_BAYER_RG_16;
+    cv::Mat plane;
+    if (pixfmt == ARV_PIXEL_FORMAT_MONO_8 ||
+        pixfmt == ARV_PIXEL_FORMAT_MONO_16) {
+#if CV_VERSION_MAJOR > 3
+        cv::cvtColor(bgr, plane, cv::COLOR_BGR2GRAY);
+#else
+        cv::cvtColor(bgr, plane, CV_BGR2GRAY);
+#endif
+    } else {
+        // RGGB mosaic, red being the third channel.
+        plane.create(bgr.size(), CV_32F);
+        for (int y = 0; y < bgr.rows; y++) {
+            auto in = bgr.ptr<cv::Vec3f>(y);
+            auto out = plane.ptr<float>(y);
+            for (int x = 0; x < bgr.cols; x++) {
+                int channel = y % 2 == 0 ? (x % 2 == 0 ? 2 : 1) :
+                                           (x % 2 == 0 ? 1 : 0);
+                out[x] = in[x][channel];
+            }
+        }
+    }
+    cv::Mat raw;
+    plane.convertTo(raw, wide ? CV_16U : CV_8U, wide ? 65535 : 255);
+    QByteArray bytes(reinterpret_cast<const char*>(raw.data),
+                     raw.total() * raw.elemSize());
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    if (wide) {
+        auto p = reinterpret_cast<quint16*>(bytes.data());
+        for (int i = 0; i < bytes.size() / 2; i++)
+            p[i] = qToLittleEndian(p[i]);
+    }
+#endif
+    return bytes;
+}
+
+struct PoolFrame {
+    int index;
+    QByteArray data;
+};
+
+SyntheticSource* SyntheticSource::instance;
+
+SyntheticSource::SyntheticSource(QObject* parent): QObject(parent)
+{
+    instance = this;
+}
+
+QString SyntheticSource::name()
+{
+    return "Synthetic";
+}
+
+QString SyntheticSource::readableName()
+{
+    return "Synthetic planet for testing";
+}
+
+VideoSourceConfigurationWidget* SyntheticSource::createConfigurationWidget()
+{
+    return new SyntheticConfigWidget;
+}
+
+SharedRawFrame SyntheticSource::createRawFrame()
+{
+    return SharedRawFrame(new SyntheticFrame);
+}
+
+SharedDecoder SyntheticSource::createDecoder()
+{
+    return SharedDecoder(new SyntheticDecoder(pixfmt, size));
+}
+
+Reader* SyntheticSource::reader()
+{
+    return reader_.data();
+}
+
+QString SyntheticSource::settingsGroup()
+{
+    return "format_" + SyntheticSource::instance->name();
+}
+
+QString SyntheticSource::initialize(QString overrideInput)
+{
+    Q_UNUSED(overrideInput);
+    size = QSize(settings.value("width", 640).toInt(),
+                 settings.value("height", 480).toInt());
+    auto format = settings.value("format", "Mono8").toString();
+    if (format == "Mono8")
+        pixfmt = ARV_PIXEL_FORMAT_MONO_8;
+    else if (format == "Mono16")
+        pixfmt = ARV_PIXEL_FORMAT_MONO_16;
+    else if (format == "BayerRG8")
+        pixfmt = ARV_PIXEL_FORMAT_BAYER_RG_8;
+    else if (format == "BayerRG16")
+        pixfmt = ARV_PIXEL_FORMAT_BAYER_RG_16;
+    else
+        return "Unknown pixel format: " + format;
+    // Percentages, except for the blur, which is in pixels.
+    double radius = settings.value("radius", 60).toDouble() / 100 *
+                    qMin(size.width(), size.height()) / 2;
+    double detail = settings.value("detail", 50).toDouble() / 100;
+    double seeing = settings.value("seeing", 2.0).toDouble();
+    double variation = settings.value("seeing_variation", 50).toDouble() / 100;
+    double noise = settings.value("noise", 1.0).toDouble() / 100;
+    int poolSize = settings.value("pool", 100).toInt();
+    qint64 frames = settings.value("frames", 1000).toLongLong();
+    bool live = settings.value("live", false).toBool();
+    double fps = settings.value("fps", 60).toDouble();
+    uint seed = settings.value("seed", 1).toUInt();
+    int defaultBuffers = 2 * QThreadPool::globalInstance()->maxThreadCount() + 4;
+    int buffers = settings.value("stream_buffers", defaultBuffers).toInt();
+    if (size.width() < 16 || size.height() < 16)
+        return "The frames must be at least 16 pixels wide and high.";
+    if (poolSize < 1 || frames < 0)
+        return "The numbers of frames must not be negative.";
+    if (live && fps <= 0)
+        return "The frame rate must be positive.";
+    variation = qBound(0., variation, 0.95);
+
+    cv::RNG rng(seed);
+    cv::Size cvSize(size.width(), size.height());
+    cv::Mat planet = makePlanet(cvSize, radius, detail, rng);
+    // The seeing goes through one cycle per pool, so that processing
+    // sees both good and bad frames no matter how long it runs. Each
+    // frame has its own generator so that the pool doesn't depend on
+    // the order in which frames are generated.
+    std::vector<PoolFrame> pool(poolSize);
+    for (int i = 0; i < poolSize; i++)
+        pool[i].index = i;
+    QtConcurrent::blockingMap(pool, [&](PoolFrame& f) {
+        cv::RNG frameRng(seed * 1000003u + f.index);
+        double cycle = std::sin(2 * pi * f.index / poolSize);
+        double sigma = seeing * (1 + variation * (0.7 * cycle +
+                                 0.3 * frameRng.uniform(-1., 1.)));
+        // Bad seeing also moves the image around.
+        cv::Mat shift = (cv::Mat_<double>(2, 3) <<
+                         1, 0, frameRng.gaussian(sigma / 2),
+                         0, 1, frameRng.gaussian(sigma / 2));
+        cv::Mat image;
+        cv::warpAffine(planet, image, shift, cvSize, cv::INTER_LINEAR,
+                       cv::BORDER_CONSTANT);
+        if (sigma > 0.3)
+            cv::GaussianBlur(image, image, cv::Size(0, 0), sigma);
+        if (noise > 0) {
+            cv::Mat grain(cvSize, CV_32FC3);
+            frameRng.fill(grain, cv::RNG::NORMAL, 0.02, noise);
+            image += grain;
+        }
+        f.data = toRaw(image, pixfmt);
+    });
+    QVector<QByteArray> frameData;
+    for (auto& f: pool)
+        frameData << f.data;
+
+    inputPath.clear();
+    reader_.reset();
+    reader_.reset(new SyntheticReader(frameData, frames, live, fps,
+                                      qMax(buffers, 2)));
+    return QString {};
+}
+
+SyntheticConfigWidget::SyntheticConfigWidget() :
+    VideoSourceConfigurationWidget("Synthetic planet configuration")
+{
+    auto layout = new QFormLayout(this);
+
+    formatSelector = new QComboBox;
+    formatSelector->addItems({"Mono8", "Mono16", "BayerRG8", "BayerRG16"});
+    layout->addRow("Format:", formatSelector);
+
+    width = new QSpinBox();
+    height = new QSpinBox();
+    width->setRange(16, 16384);
+    height->setRange(16, 16384);
+    layout->addRow("Width:", width);
+    layout->addRow("Height:", height);
+
+    radius = new QSpinBox;
+    radius->setRange(1, 100);
+    radius->setSuffix(" %");
+    layout->addRow("Planet size:", radius);
+
+    detail = new QSpinBox;
+    detail->setRange(0, 100);
+    detail->setSuffix(" %");
+    layout->addRow("Detail:", detail);
+
+    seeing = new QDoubleSpinBox;
+    seeing->setRange(0, 50);
+    seeing->setSingleStep(0.5);
+    seeing->setSuffix(" px");
+    layout->addRow("Seeing blur:", seeing);
+
+    variation = new QSpinBox;
+    variation->setRange(0, 95);
+    variation->setSuffix(" %");
+    layout->addRow("Seeing variation:", variation);
+
+    noise = new QDoubleSpinBox;
+    noise->setRange(0, 50);
+    noise->setSingleStep(0.5);
+    noise->setSuffix(" %");
+    layout->addRow("Noise:", noise);
+
+    pool = new QSpinBox;
+    pool->setRange(1, 100000);
+    layout->addRow("Generated frames:", pool);
+
+    frames = new QSpinBox;
+    frames->setRange(0, 1000000000);
+    frames->setSpecialValueText("Endless");
+    layout->addRow("Delivered frames:", frames);
+
+    liveCheckBox = new QCheckBox("Deliver at the frame rate, like a camera");
+    layout->addRow(liveCheckBox);
+
+    fps = new QDoubleSpinBox;
+    fps->setRange(0.1, 100000);
+    fps->setSuffix(" fps");
+    layout->addRow("Frame rate:", fps);
+    connect(liveCheckBox, SIGNAL(toggled(bool)), fps, SLOT(setEnabled(bool)));
+
+    auto finishButton = new QPushButton("Finish");
+    layout->addRow(finishButton);
+    this->connect(finishButton, SIGNAL(clicked(bool)), SLOT(checkConfig()));
+    restoreConfig();
+}
+
+void SyntheticConfigWidget::checkConfig()
+{
+    SyntheticSource* s = SyntheticSource::instance;
+    saveConfig();
+    auto result = s->initialize();
+    if (result.isNull()) {
+        s->saveSettings();
+        emit configurationComplete();
+    } else {
+        QMessageBox tmp;
+        tmp.setWindowTitle("Error");
+        tmp.setText(result);
+        tmp.exec();
+    }
+}
+
+void SyntheticConfigWidget::saveConfig()
+{
+    auto s = SyntheticSource::instance;
+    s->settings.insert("format", formatSelector->currentText());
+    s->settings.insert("width", width->value());
+    s->settings.insert("height", height->value());
+    s->settings.insert("radius", radius->value());
+    s->settings.insert("detail", detail->value());
+    s->settings.insert("seeing", seeing->value());
+    s->settings.insert("seeing_variation", variation->value());
+    s->settings.insert("noise", noise->value());
+    s->settings.insert("pool", pool->value());
+    s->settings.insert("frames", frames->value());
+    s->settings.insert("live", liveCheckBox->isChecked());
+    s->settings.insert("fps", fps->value());
+}
+
+void SyntheticConfigWidget::restoreConfig()
+{
+    auto s = SyntheticSource::instance;
+    s->readSettings();
+    int idx = formatSelector->findText(s->settings.value("format", "Mono8").toString());
+    formatSelector->setCurrentIndex(qMax(idx, 0));
+    width->setValue(s->settings.value("width", 640).toInt());
+    height->setValue(s->settings.value("height", 480).toInt());
+    radius->setValue(s->settings.value("radius", 60).toInt());
+    detail->setValue(s->settings.value("detail", 50).toInt());
+    seeing->setValue(s->settings.value("seeing", 2.0).toDouble());
+    variation->setValue(s->settings.value("seeing_variation", 50).toInt());
+    noise->setValue(s->settings.value("noise", 1.0).toDouble());
+    pool->setValue(s->settings.value("pool", 100).toInt());
+    frames->setValue(s->settings.value("frames", 1000).toInt());
+    liveCheckBox->setChecked(s->settings.value("live", false).toBool());
+    fps->setValue(s->settings.value("fps", 60).toDouble());
+    fps->setEnabled(liveCheckBox->isChecked());
+}
+
+Q_IMPORT_PLUGIN(SyntheticSource)
@@ -0,0 +1,191 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#define QT_STATICPLUGIN
+
+#include "videosources/interfaces.h"
+#include <qarvdecoder.h>
+#include <QSpinBox>
+#include <QDoubleSpinBox>
+#include <QCheckBox>
+#include <QComboBox>
+#include <QThread>
+#include <QMutex>
+#include <atomic>
+
+/*
+ * A video source that makes up frames of a banded planet, blurred by
+ * seeing that changes from frame to frame and with added noise. The
+ * frames are generated in advance into a pool that is played back over
+ * and over, so that producing them costs next to nothing, and they are
+ * decoded the same way as frames of an Ethernet camera. It allows
+ * measuring how fast frames can be processed, and how processing keeps
+ * up with a camera at a given frame rate, without a camera or a display.
+ */
+namespace Synthetic
+{
+
+class SyntheticReader;
+
+class SyntheticSource: public QObject, public VideoSourcePlugin
+{
+    Q_OBJECT
+    Q_INTERFACES(VideoSourcePlugin)
+    Q_PLUGIN_METADATA(IID "si.ad-vega.arif.SyntheticSource")
+
+public:
+    explicit SyntheticSource(QObject* parent = 0);
+    QString name();
+    QString readableName();
+    VideoSourceConfigurationWidget* createConfigurationWidget();
+    SharedRawFrame createRawFrame();
+    SharedDecoder createDecoder();
+    Reader* reader();
+    QString settingsGroup();
+    // The input is ignored, frames are always made up.
+    QString initialize(QString overrideInput = QString{});
+
+    static SyntheticSource* instance;
+
+private:
+    QSize size;
+    ArvPixelFormat pixfmt = 0;
+    QScopedPointer<SyntheticReader> reader_;
+
+    friend class SyntheticConfigWidget;
+    friend class SyntheticFrame;
+    friend class SyntheticReader;
+    friend class SyntheticDecoder;
+};
+
+class SyntheticConfigWidget : public VideoSourceConfigurationWidget
+{
+    Q_OBJECT
+
+public:
+    explicit SyntheticConfigWidget();
+
+private slots:
+    void checkConfig();
+
+private:
+    void saveConfig();
+    void restoreConfig();
+
+    QSpinBox* width, * height, * radius, * detail, * variation, * pool;
+    QSpinBox* frames;
+    QDoubleSpinBox* seeing, * noise, * fps;
+    QComboBox* formatSelector;
+    QCheckBox* liveCheckBox;
+};
+
+class SyntheticFrame: public RawFrame
+{
+public:
+    SharedRawFrame copy();
+    VideoSourcePlugin* plugin();
+    void serialize(QDataStream& s);
+    void load(QDataStream& s);
+
+private:
+    // Shares the data with the pool.
+    QByteArray frame;
+    friend class SyntheticDecoder;
+    friend class SyntheticReader;
+};
+
+class SyntheticDecoder: public Decoder
+{
+public:
+    SyntheticDecoder(ArvPixelFormat pixfmt, QSize size);
+    const cv::Mat decode(RawFrame* in);
+    VideoSourcePlugin* plugin();
+
+private:
+    QScopedPointer<QArvDecoder> thedecoder;
+};
+
+// Hands live frames to the reader at the frame rate.
+class PacingThread: public QThread
+{
+    Q_OBJECT
+
+public:
+    PacingThread(SyntheticReader* reader_, double fps_):
+        QThread(), reader(reader_), fps(fps_) {}
+
+    void stop();
+
+protected:
+    void run();
+
+private:
+    SyntheticReader* reader;
+    double fps;
+    std::atomic<bool> quit{false};
+};
+
+class SyntheticReader: public Reader
+{
+    Q_OBJECT
+
+public:
+    // Frames are taken from the pool in turn. Unless live, they are
+    // delivered when asked for and can be sought if their number is
+    // limited. A number of zero means that frames never run out.
+    SyntheticReader(QVector<QByteArray> pool, qint64 frames, bool live,
+                    double fps, int queueLimit);
+    ~SyntheticReader();
+    bool seek(qint64 frame);
+    bool isSequential();
+    quint64 numberOfFrames();
+    VideoSourcePlugin* plugin();
+
+public slots:
+    void readFrame();
+
+private slots:
+    void liveFramesReady();
+
+private:
+    SharedRawFrame makeFrame(qint64 index);
+    // Called by the pacing thread, returns false once all frames were made.
+    bool pace();
+
+    const QVector<QByteArray> pool;
+    const qint64 frames;
+    const bool live;
+    qint64 position = 0; // Only used by the pacing thread when live.
+    PacingThread pacer;
+    // Live frames made since the main thread last took them, up to the
+    // limit. Frames beyond it are dropped, like a camera that runs out
+    // of buffers.
+    QMutex liveMutex;
+    QVector<SharedRawFrame> liveFrames;
+    bool liveAtEnd = false;
+    int queueLimit;
+    quint64 dropped = 0;
+    friend class PacingThread;
+};
+
+}
+
+#endif
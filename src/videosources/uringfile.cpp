@@ -0,0 +1,225 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "videosources/uringfile.h"
+#include <QVector>
+#include <cerrno>
+
+#ifdef HAVE_LIBURING
+
+#include <QVarLengthArray>
+#include <utility>
+extern "C" {
+#include <liburing.h>
+}
+
+namespace {
+
+struct Slot {
+    FrameBuffer buffer;
+    qint64 offset = 0;
+    size_t done = 0;   // Bytes read so far.
+    int error = 0;     // Negative errno.
+    bool inFlight = false;
+    bool complete = false;
+};
+
+}
+
+struct UringFileReader::Private {
+    io_uring ring;
+    bool valid = false;
+    int fd;
+    size_t blockBytes;
+    QVector<Slot> slots;
+    int head = 0;      // Slot of the next block to hand out.
+    int queued = 0;    // Slots, starting at head, that hold a requested block.
+    int inFlight = 0;  // Reads submitted to the kernel but not yet reaped.
+    qint64 nextOffset; // Offset of the next block to request.
+    bool atEnd = false;
+
+    void submitRead(int index);
+    void fill();
+    bool reap();
+};
+
+void UringFileReader::Private::submitRead(int index)
+{
+    Slot& s = slots[index];
+    auto sqe = io_uring_get_sqe(&ring);
+    // Each slot has at most one read in flight and the submission
+    // queue is as deep as there are slots, so this can't fail.
+    io_uring_prep_read(sqe, fd, s.buffer.data() + s.done,
+                       blockBytes - s.done, s.offset + s.done);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(quintptr(index)));
+    s.inFlight = true;
+    inFlight++;
+}
+
+// Requests blocks until all slots are in use.
+void UringFileReader::Private::fill()
+{
+    bool submitted = false;
+    while (!atEnd && queued < slots.size()) {
+        int index = (head + queued) % slots.size();
+        Slot& s = slots[index];
+        s.offset = nextOffset;
+        s.done = 0;
+        s.error = 0;
+        s.complete = false;
+        nextOffset += blockBytes;
+        queued++;
+        submitRead(index);
+        submitted = true;
+    }
+    if (submitted)
+        io_uring_submit(&ring);
+}
+
+// Waits for at least one completion and handles all that are available.
+bool UringFileReader::Private::reap()
+{
+    io_uring_cqe* cqe;
+    int status;
+    do {
+        status = io_uring_wait_cqe(&ring, &cqe);
+    } while (status == -EINTR);
+    if (status < 0)
+        return false;
+
+    QVarLengthArray<io_uring_cqe*, 32> cqes(slots.size());
+    unsigned count = io_uring_peek_batch_cqe(&ring, cqes.data(), cqes.size());
+    bool resubmitted = false;
+    for (unsigned i = 0; i < count; i++) {
+        int index = int(quintptr(io_uring_cqe_get_data(cqes[i])));
+        int res = cqes[i]->res;
+        Slot& s = slots[index];
+        s.inFlight = false;
+        inFlight--;
+        if (res == -EAGAIN || res == -EINTR) {
+            submitRead(index);
+            resubmitted = true;
+            continue;
+        }
+        if (res < 0) {
+            s.error = res;
+        } else {
+            s.done += res;
+            if (res > 0 && s.done < blockBytes) {
+                // Short read in the middle of the file, get the rest.
+                submitRead(index);
+                resubmitted = true;
+                continue;
+            }
+        }
+        s.complete = true;
+    }
+    io_uring_cq_advance(&ring, count);
+    if (resubmitted)
+        io_uring_submit(&ring);
+    return true;
+}
+
+UringFileReader::UringFileReader(int fd, qint64 firstOffset,
+                                 size_t blockBytes, int depth):
+    d(new Private)
+{
+    depth = qMax(depth, 1);
+    d->fd = fd;
+    d->blockBytes = blockBytes;
+    d->nextOffset = firstOffset;
+    if (io_uring_queue_init(depth, &d->ring, 0) < 0)
+        return;
+    d->valid = true;
+    d->slots.resize(depth);
+    for (auto& s : d->slots)
+        s.buffer.resize(blockBytes);
+}
+
+UringFileReader::~UringFileReader()
+{
+    if (!d->valid)
+        return;
+    // The kernel may still write into the buffers.
+    while (d->inFlight > 0 && d->reap());
+    io_uring_queue_exit(&d->ring);
+}
+
+bool UringFileReader::isValid() const
+{
+    return d->valid;
+}
+
+void UringFileReader::seek(qint64 offset)
+{
+    while (d->inFlight > 0 && d->reap());
+    d->head = 0;
+    d->queued = 0;
+    d->nextOffset = offset;
+    d->atEnd = false;
+}
+
+qint64 UringFileReader::next(FrameBuffer* buffer)
+{
+    d->fill();
+    if (d->queued == 0)
+        return 0;
+    Slot& s = d->slots[d->head];
+    while (!s.complete) {
+        if (!d->reap())
+            return -EIO;
+    }
+    qint64 result = s.error < 0 ? s.error : qint64(s.done);
+    if (result < qint64(d->blockBytes)) {
+        // Blocks after this one are past the end or failed as well.
+        d->atEnd = true;
+    }
+    std::swap(*buffer, s.buffer);
+    if (s.buffer.size() != d->blockBytes)
+        s.buffer.resize(d->blockBytes);
+    d->head = (d->head + 1) % d->slots.size();
+    d->queued--;
+    if (d->atEnd) {
+        // Don't hand out the remaining blocks.
+        while (d->inFlight > 0 && d->reap());
+        d->queued = 0;
+    }
+    return result;
+}
+
+#else
+
+struct UringFileReader::Private {};
+
+UringFileReader::UringFileReader(int, qint64, size_t, int): d(new Private) {}
+
+UringFileReader::~UringFileReader() {}
+
+bool UringFileReader::isValid() const
+{
+    return false;
+}
+
+void UringFileReader::seek(qint64) {}
+
+qint64 UringFileReader::next(FrameBuffer*)
+{
+    return -ENOSYS;
+}
+
+#endif
@@ -0,0 +1,58 @@
+/*
+    arif, ADV Realtime Image Filtering, a tool for amateur astronomy.
+    Copyright (C) 2014 Jure Varlec <jure.varlec@ad-vega.si>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VIDEOSOURCES_URINGFILE_H
+#define VIDEOSOURCES_URINGFILE_H
+
+#include "bufferpool.h"
+#include <QScopedPointer>
+
+/*
+ * Reads consecutive blocks of equal size from a regular file with io_uring.
+ * Several reads are kept in flight at explicit offsets and their completions
+ * are reaped in batches, so that reading a block usually costs neither a
+ * system call nor a wakeup. When arif is built without liburing or the
+ * kernel doesn't support io_uring, isValid() returns false and the caller
+ * should read the file by other means.
+ */
+class UringFileReader
+{
+public:
+    UringFileReader(int fd, qint64 firstOffset, size_t blockBytes, int depth);
+    ~UringFileReader();
+    UringFileReader(const UringFileReader&) = delete;
+    UringFileReader& operator=(const UringFileReader&) = delete;
+
+    bool isValid() const;
+
+    // Discards reads in flight and continues at the given offset.
+    void seek(qint64 offset);
+
+    // Blocks until the next block is read and moves it into the buffer.
+    // Returns the number of bytes read, which is less than the block size
+    // only at the end of the file, or a negative errno value.
+    qint64 next(FrameBuffer* buffer);
+
+    static const int defaultDepth = 4;
+
+private:
+    struct Private;
+    QScopedPointer<Private> d;
+};
+
+#endif